@@ -0,0 +1,575 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "alerts.h"
+#include "raw_io.h"
+
+/* Version of the state file layout */
+#define ALERT_STATE_VERSION 2
+
+/* Samples in the moving average of the discharge rate */
+#define RATE_AVERAGE_SAMPLES 8
+
+/* Samples in the average before it is a baseline for spikes */
+#define MIN_SPIKE_SAMPLES 4
+
+/* Largest rules file read */
+#define MAX_RULES_SIZE (64 * 1024)
+
+/* Longest line of the state file */
+#define MAX_STATE_LINE 64
+
+/**
+ * How each metric is written in the rules
+ */
+struct MetricInfo
+{
+    const char * name;
+    double scale;               /* To the sample's units */
+    double band;                /* Default hysteresis, in the rule's units */
+    bool relative;              /* band is a fraction of the value */
+};
+
+static const MetricInfo metrics[ALERT_NUM_METRICS] = {
+    {"percent", 1, 5, false},
+    {"minutes", 1, 10, false},
+    {"rate", 1000000, 0.1, true},
+    {"health", 10000, 1, false},
+    {"spike", 1, 20, false}
+};
+
+/**
+ * Copy the next space separated token of a line
+ *
+ * @param[in,out] pos Where to start, moved past the token
+ * @param[out] token The token, truncated to maxlen
+ * @param[in] maxlen The size of token
+ *
+ * @return false if there are no more
+ */
+static bool next_token(const char ** pos, char * token, size_t maxlen)
+{
+    const char * start = *pos + strspn(*pos, " \t");
+    const size_t length = strcspn(start, " \t\n#");
+    *pos = start + length;
+    if(length == 0) {
+        return false;
+    }
+    const size_t copy = length < maxlen ? length : maxlen - 1;
+    memcpy(token, start, copy);
+    token[copy] = '\0';
+    return true;
+}
+
+/**
+ * Parse the whole of a token as a number
+ */
+static bool to_number(const char * token, double * value)
+{
+    char * end;
+    *value = strtod(token, &end);
+    return (end != token) && (*end == '\0');
+}
+
+static uint32_t fnv1a(uint32_t hash, const void * data, size_t length)
+{
+    const uint8_t * bytes = static_cast<const uint8_t *>(data);
+    for(size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * 16777619u;
+    }
+    return hash;
+}
+
+/**
+ * The AlertEngine constructor, with no rules
+ */
+AlertEngine::AlertEngine()
+{
+    memset(this, 0, sizeof(*this));
+    m_left = 999;
+}
+
+AlertEngine::~AlertEngine()
+{
+    free(m_rules);
+    free(m_active);
+    free(m_last_fired);
+}
+
+/**
+ * Get the index of a battery, adding it if it's new
+ *
+ * @return The index, -1 if there are too many or the name is too long
+ */
+int AlertEngine::pack_index(const char * name)
+{
+    for(unsigned i = 0; i < m_num_packs; i++) {
+        if(strcmp(m_packs[i], name) == 0) {
+            return i;
+        }
+    }
+    if((m_num_packs >= MAX_ALERT_PACKS) || (strlen(name) > MAX_ALERT_PACK_NAME)) {
+        return -1;
+    }
+    strcpy(m_packs[m_num_packs], name);
+    return m_num_packs++;
+}
+
+/**
+ * Make room for more rules, and their state
+ */
+bool AlertEngine::grow_state(uint32_t rules_size)
+{
+    const size_t slots = static_cast<size_t>(rules_size) * MAX_ALERT_PACKS;
+    const size_t old_slots = static_cast<size_t>(m_rules_size) * MAX_ALERT_PACKS;
+    AlertRule * rules = static_cast<AlertRule *>(
+            realloc(m_rules, rules_size * sizeof(AlertRule)));
+    if(rules) {
+        m_rules = rules;
+    }
+    uint8_t * active = static_cast<uint8_t *>(realloc(m_active, slots));
+    if(active) {
+        m_active = active;
+    }
+    int64_t * last_fired = static_cast<int64_t *>(
+            realloc(m_last_fired, slots * sizeof(int64_t)));
+    if(last_fired) {
+        m_last_fired = last_fired;
+    }
+    if(!rules || !active || !last_fired) {
+        return false;
+    }
+    memset(m_active + old_slots, 0, slots - old_slots);
+    memset(m_last_fired + old_slots, 0, (slots - old_slots) * sizeof(int64_t));
+    m_rules_size = rules_size;
+    return true;
+}
+
+/**
+ * Compile a line of the rules (see alerts.h) into the table
+ *
+ * @param[in] line The line, blank or a comment adds nothing
+ *
+ * @return false if it isn't a valid rule
+ */
+bool AlertEngine::add_rule(const char * line)
+{
+    char token[32];
+    const char * pos = line;
+    if(!next_token(&pos, token, sizeof(token))) {
+        return true;
+    }
+
+    AlertRule rule;
+    memset(&rule, 0, sizeof(rule));
+    unsigned metric = 0;
+    while((metric < ALERT_NUM_METRICS) && (strcmp(token, metrics[metric].name) != 0)) {
+        metric++;
+    }
+    if(metric == ALERT_NUM_METRICS) {
+        return false;
+    }
+    rule.metric = metric;
+
+    if(!next_token(&pos, token, sizeof(token))) {
+        return false;
+    }
+    if(strcmp(token, "*") != 0) {
+        const int pack = pack_index(token);
+        if(pack < 0) {
+            return false;
+        }
+        rule.pack = pack + 1;
+    }
+
+    double value;
+    char value_token[32];
+    if(!next_token(&pos, token, sizeof(token))
+            || ((strcmp(token, "<") != 0) && (strcmp(token, ">") != 0))
+            || !next_token(&pos, value_token, sizeof(value_token))
+            || !to_number(value_token, &value)) {
+        return false;
+    }
+    rule.sign = token[0] == '<' ? 1 : -1;
+    const MetricInfo & info = metrics[metric];
+    double clear = value + rule.sign * (info.relative ? info.band * value : info.band);
+    double cooldown = 0;
+
+    while(next_token(&pos, token, sizeof(token))) {
+        double * option = strcmp(token, "clear") == 0 ? &clear
+            : strcmp(token, "cooldown") == 0 ? &cooldown : NULL;
+        if(!option || !next_token(&pos, value_token, sizeof(value_token))
+                || !to_number(value_token, option)) {
+            return false;
+        }
+    }
+    /* Clears on the far side of where it fires, or it would never stop */
+    if((rule.sign * (clear - value) < 0) || (cooldown < 0)) {
+        return false;
+    }
+    rule.trigger = rule.sign * static_cast<int64_t>(value * info.scale);
+    rule.clear = rule.sign * static_cast<int64_t>(clear * info.scale);
+    rule.cooldown = static_cast<int32_t>(cooldown * 60);
+
+    if(m_num_rules >= MAX_ALERT_RULES) {
+        return false;
+    }
+    if((m_num_rules == m_rules_size)
+            && !grow_state(m_rules_size ? m_rules_size * 2 : 16)) {
+        return false;
+    }
+    m_rules[m_num_rules++] = rule;
+    return true;
+}
+
+/**
+ * Load the rules file, once at startup
+ *
+ * @param[in] path The file
+ *
+ * @return The number of rules, -1 if there is no file or not one rule in
+ *      it could be used, so the defaults are used rather than no alerts
+ */
+int AlertEngine::load(const char * path)
+{
+    char * buf = static_cast<char *>(malloc(MAX_RULES_SIZE));
+    if(!buf) {
+        return -1;
+    }
+    const ssize_t length = read_file(path, buf, MAX_RULES_SIZE);
+    if(length < 0) {
+        free(buf);
+        return -1;
+    }
+    const uint32_t before = m_num_rules;
+    int line_num = 1;
+    for(char * line = buf; *line; line_num++) {
+        char * end = strchr(line, '\n');
+        if(end) {
+            *end++ = '\0';
+        }
+        else {
+            end = line + strlen(line);
+        }
+        if(!add_rule(line)) {
+            err_printf("%s:%i: bad alert rule\n", path, line_num);
+        }
+        line = end;
+    }
+    free(buf);
+    if(m_num_rules == before) {
+        err_printf("%s: no alert rules, using the defaults\n", path);
+        return -1;
+    }
+    return m_num_rules - before;
+}
+
+/**
+ * Add the rules for when there is no rules file, as the checker always
+ * alerted, and a health rule if one was asked for
+ *
+ * @param[in] low_threshold Mins left at which to alert
+ * @param[in] health_threshold Health (in %) at which to replace a battery,
+ *      0 for none
+ * @param[in] cooldown Mins between reminders
+ */
+void AlertEngine::add_defaults(int low_threshold, int health_threshold,
+        int cooldown)
+{
+    char line[128];
+    snprintf(line, sizeof(line), "minutes * < %i cooldown %i", low_threshold,
+            cooldown);
+    add_rule(line);
+    if(health_threshold > 0) {
+        snprintf(line, sizeof(line), "health * < %i cooldown %i",
+                health_threshold, 24 * 60);
+        add_rule(line);
+    }
+}
+
+/**
+ * A hash of the rules, so the state of different rules isn't loaded
+ */
+uint32_t AlertEngine::table_hash() const
+{
+    uint32_t hash = 2166136261u;
+    for(uint32_t i = 0; i < m_num_rules; i++) {
+        const AlertRule & rule = m_rules[i];
+        const char * pack = rule.pack ? m_packs[rule.pack - 1] : "*";
+        hash = fnv1a(hash, &rule.trigger, sizeof(rule.trigger));
+        hash = fnv1a(hash, &rule.clear, sizeof(rule.clear));
+        hash = fnv1a(hash, &rule.cooldown, sizeof(rule.cooldown));
+        hash = fnv1a(hash, &rule.metric, sizeof(rule.metric));
+        hash = fnv1a(hash, &rule.sign, sizeof(rule.sign));
+        hash = fnv1a(hash, pack, strlen(pack) + 1);
+    }
+    return hash;
+}
+
+/**
+ * Load which rules were firing, and when they last fired, as saved by the
+ * last run, only if the rules are the same. Then the average discharge
+ * rates, whatever the rules.
+ */
+void AlertEngine::load_state(const char * path)
+{
+    const size_t maxlen = (static_cast<size_t>(m_num_rules) + 1) * MAX_ALERT_PACKS
+        * MAX_STATE_LINE + MAX_STATE_LINE;
+    char * buf = static_cast<char *>(malloc(maxlen));
+    if(!buf) {
+        return;
+    }
+    if(read_file(path, buf, maxlen) > 0) {
+        /* Parsed by hand rather than with fscanf(), no stdio */
+        char * pos = buf;
+        const long version = strtol(pos, &pos, 10);
+        const unsigned long hash = strtoul(pos, &pos, 10);
+        if(version == ALERT_STATE_VERSION) {
+            const bool same_rules = hash == table_hash();
+            char kind[2];
+            char name[MAX_ALERT_PACK_NAME + 1];
+            const char * line = pos + strspn(pos, "\n");
+            while(next_token(&line, kind, sizeof(kind))
+                    && next_token(&line, name, sizeof(name))) {
+                char * end;
+                const int pack = pack_index(name);
+                if(kind[0] == 'R') {
+                    /* R <pack> <rule> <active> <last fired> */
+                    const unsigned long rule = strtoul(line, &end, 10);
+                    const long active = strtol(end, &end, 10);
+                    const int64_t last_fired = strtoll(end, &end, 10);
+                    if(same_rules && (pack >= 0) && (rule < m_num_rules)) {
+                        const size_t slot = rule * MAX_ALERT_PACKS + pack;
+                        m_active[slot] = active != 0;
+                        m_last_fired[slot] = last_fired;
+                    }
+                }
+                else {
+                    /* A <pack> <average rate> <samples> */
+                    const int64_t average = strtoll(line, &end, 10);
+                    const unsigned long samples = strtoul(end, &end, 10);
+                    if((pack >= 0) && (average > 0)
+                            && (samples <= RATE_AVERAGE_SAMPLES)) {
+                        m_average_rate[pack] = average;
+                        m_rate_samples[pack] = samples;
+                    }
+                }
+                line = end;
+                line += strcspn(line, "\n");
+                line += strspn(line, "\n");
+            }
+        }
+    }
+    free(buf);
+    m_changed = false;
+}
+
+/**
+ * Save which rules are firing, when they last fired and the average
+ * discharge rates, if any of it has changed
+ */
+void AlertEngine::save_state(const char * path)
+{
+    if(!m_changed) {
+        return;
+    }
+    const size_t maxlen = (static_cast<size_t>(m_num_rules) + 1) * MAX_ALERT_PACKS
+        * MAX_STATE_LINE + MAX_STATE_LINE;
+    char * buf = static_cast<char *>(malloc(maxlen));
+    if(!buf) {
+        return;
+    }
+    size_t length = snprintf(buf, maxlen, "%i %" PRIu32 "\n",
+            ALERT_STATE_VERSION, table_hash());
+    for(uint32_t i = 0; i < m_num_rules; i++) {
+        for(unsigned p = 0; p < m_num_packs; p++) {
+            const size_t slot = i * MAX_ALERT_PACKS + p;
+            if(m_active[slot] || m_last_fired[slot]) {
+                length += snprintf(buf + length, maxlen - length,
+                        "R %s %" PRIu32 " %i %" PRId64 "\n", m_packs[p], i,
+                        m_active[slot], m_last_fired[slot]);
+            }
+        }
+    }
+    for(unsigned p = 0; p < m_num_packs; p++) {
+        if(m_rate_samples[p]) {
+            length += snprintf(buf + length, maxlen - length,
+                    "A %s %" PRId64 " %u\n", m_packs[p], m_average_rate[p],
+                    m_rate_samples[p]);
+        }
+    }
+    if(write_file(path, buf, length)) {
+        m_changed = false;
+    }
+    free(buf);
+}
+
+/**
+ * Work out a discharge rate as a % of the battery's recent average, once
+ * there is enough of an average, then add the rate to the average
+ *
+ * @param[in] pack The battery
+ * @param[in,out] sample Its values, the spike is added
+ */
+void AlertEngine::add_rate(unsigned pack, AlertSample * sample)
+{
+    const int64_t rate = sample->values[ALERT_RATE];
+    int64_t & average = m_average_rate[pack];
+    unsigned & samples = m_rate_samples[pack];
+    if((samples >= MIN_SPIKE_SAMPLES) && (average > 0)) {
+        sample->values[ALERT_SPIKE] = rate * 100 / average;
+        sample->known |= 1u << ALERT_SPIKE;
+    }
+    if(samples < RATE_AVERAGE_SAMPLES) {
+        samples++;
+    }
+    average += (rate - average) / static_cast<int64_t>(samples);
+    m_changed = true;
+}
+
+/**
+ * Note a rule firing, for take_fired()
+ */
+void AlertEngine::fire(const AlertRule & rule, unsigned pack,
+        const AlertSample & sample)
+{
+    const int64_t value = sample.values[rule.metric];
+    if((sample.known & (1u << ALERT_MINUTES)) && (sample.values[ALERT_MINUTES] < m_left)) {
+        m_left = sample.values[ALERT_MINUTES];
+    }
+    if(m_fired == 0) {
+        m_message_length = 0;
+        m_message[0] = '\0';
+    }
+    m_fired++;
+    /* Only counted once the message is full */
+    if(m_message_length >= sizeof(m_message)) {
+        return;
+    }
+
+    char text[64];
+    switch(rule.metric)
+    {
+        case ALERT_PERCENT:
+            snprintf(text, sizeof(text), "%s at %" PRId64 "%%", m_packs[pack], value);
+            break;
+
+        case ALERT_MINUTES:
+            snprintf(text, sizeof(text), "%s %" PRId64 " mins left", m_packs[pack], value);
+            break;
+
+        case ALERT_RATE:
+            snprintf(text, sizeof(text), "%s discharging at %.1f W", m_packs[pack],
+                    value / 1000000.0);
+            break;
+
+        case ALERT_SPIKE:
+            snprintf(text, sizeof(text), "%s discharging at %.1f W, %" PRId64
+                    "%% of its average", m_packs[pack],
+                    sample.values[ALERT_RATE] / 1000000.0, value);
+            break;
+
+        default:
+            snprintf(text, sizeof(text), "%s health %.0f%%", m_packs[pack],
+                    value / 10000.0);
+            break;
+    }
+    const int length = snprintf(m_message + m_message_length,
+            sizeof(m_message) - m_message_length, "%s%s",
+            m_message_length ? ", " : "", text);
+    if((length > 0) && (m_message_length + length < sizeof(m_message))) {
+        m_message_length += length;
+    }
+    else {
+        m_message[m_message_length] = '\0';
+        m_message_length = sizeof(m_message);
+    }
+}
+
+/**
+ * Check a battery's sample against the rules
+ *
+ * @param[in] pack The battery's name
+ * @param[in] sample Its values, without the spike which is worked out here
+ * @param[in] now The time of the sample
+ *
+ * @return The number of rules that fired
+ */
+unsigned AlertEngine::evaluate(const char * pack, const AlertSample & sample,
+        time_t now)
+{
+    const int p = pack_index(pack);
+    if(p < 0) {
+        return 0;
+    }
+    AlertSample with_spike = sample;
+    with_spike.known &= ~(1u << ALERT_SPIKE);
+    if(sample.known & (1u << ALERT_RATE)) {
+        add_rate(p, &with_spike);
+    }
+
+    unsigned fired = 0;
+    const AlertRule * rule = m_rules;
+    for(uint32_t i = 0; i < m_num_rules; i++, rule++) {
+        if((rule->pack && (rule->pack != p + 1))
+                || !(with_spike.known & (1u << rule->metric))) {
+            continue;
+        }
+        const int64_t value = rule->sign * with_spike.values[rule->metric];
+        const size_t slot = i * MAX_ALERT_PACKS + p;
+        if(m_active[slot]) {
+            if(value >= rule->clear) {
+                m_active[slot] = 0;
+                m_changed = true;
+                continue;
+            }
+            /* Still firing, a reminder once the cooldown is over */
+            if(!rule->cooldown || (now - m_last_fired[slot] < rule->cooldown)) {
+                continue;
+            }
+        }
+        else {
+            if(value >= rule->trigger) {
+                continue;
+            }
+            m_active[slot] = 1;
+            m_changed = true;
+            /* Started again, but too soon after it last fired */
+            if(m_last_fired[slot] && (now - m_last_fired[slot] < rule->cooldown)) {
+                continue;
+            }
+        }
+        m_last_fired[slot] = now;
+        m_changed = true;
+        fire(*rule, p, with_spike);
+        fired++;
+    }
+    return fired;
+}
+
+/**
+ * Take what has fired since the last call
+ *
+ * @param[out] left The fewest mins left of the batteries that fired, 999 if
+ *      unknown
+ * @param[out] message What fired, valid until the next evaluate()
+ *
+ * @return The number of rules that fired
+ */
+unsigned AlertEngine::take_fired(int * left, const char ** message)
+{
+    const unsigned fired = m_fired;
+    *left = m_left;
+    *message = m_message;
+    m_fired = 0;
+    m_left = 999;
+    return fired;
+}
@@ -0,0 +1,128 @@
+#ifndef _ALERTS_H_
+#define _ALERTS_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * The alert rules, one a line of the rules file:
+ *
+ *     <metric> <pack> <op> <value> [clear <value>] [cooldown <mins>]
+ *
+ *     metric   percent (%), minutes (left), rate (W discharging, an
+ *              absolute limit), spike (the discharge rate as a % of the
+ *              battery's recent average) or health (% of the design
+ *              capacity)
+ *     pack     A battery name (as in /sys/class/power_supply), or * for
+ *              each battery
+ *     op       < to fire below the value, > to fire above it
+ *     clear    Where the rule clears again (its hysteresis), by default a
+ *              little past the value
+ *     cooldown Mins before the rule can fire again for the battery, while
+ *              it is still firing too. 0 (the default) to only fire as it
+ *              starts to.
+ *
+ * For example:
+ *
+ *     percent * < 10 clear 15 cooldown 5
+ *     rate BAT1 > 25
+ *     spike * > 200
+ *
+ * The rules are compiled once into a table, then each sample is checked
+ * against every rule, with nothing but the values the checker has already
+ * read. Which rules are firing, and when they last fired, is kept between
+ * runs, as is the moving average of each battery's discharge rate.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "root_prefix.h"
+
+#define ALERT_RULES ROOT_PREFIX "/etc/batt_checker/alerts"
+#define ALERT_STATE ROOT_PREFIX "/var/cache/batt_checker/alert_state"
+
+#define MAX_ALERT_RULES 1024
+
+/* Batteries tracked, and the longest name */
+#define MAX_ALERT_PACKS 8
+#define MAX_ALERT_PACK_NAME 15
+
+enum AlertMetric
+{
+    ALERT_PERCENT,              /* % */
+    ALERT_MINUTES,              /* Mins */
+    ALERT_RATE,                 /* uW */
+    ALERT_HEALTH,               /* Parts per million */
+    ALERT_SPIKE,                /* % of the average rate, set by the engine */
+    ALERT_NUM_METRICS
+};
+
+/**
+ * A battery's sample, as the rules see it
+ */
+struct AlertSample
+{
+    int64_t values[ALERT_NUM_METRICS];
+    unsigned known;             /* Bit for each metric with a value */
+};
+
+/**
+ * A compiled rule. Rules that fire above their value are stored negated,
+ * so every rule is a "less than".
+ */
+struct AlertRule
+{
+    int64_t trigger;
+    int64_t clear;
+    int32_t cooldown;           /* Secs */
+    uint8_t metric;
+    uint8_t pack;               /* Pack + 1, 0 for every pack */
+    int8_t sign;                /* -1 if it fires above its value */
+    uint8_t reserved;
+};
+
+class AlertEngine
+{
+private:
+    AlertRule * m_rules;
+    uint32_t m_num_rules;
+    uint32_t m_rules_size;
+    char m_packs[MAX_ALERT_PACKS][MAX_ALERT_PACK_NAME + 1];
+    unsigned m_num_packs;
+    int64_t m_average_rate[MAX_ALERT_PACKS];    /* uW, for spikes */
+    unsigned m_rate_samples[MAX_ALERT_PACKS];   /* In the average so far */
+    uint8_t * m_active;         /* For each rule and pack */
+    int64_t * m_last_fired;     /* For each rule and pack, 0 if never */
+    bool m_changed;
+
+    /* What fired since the last take_fired() */
+    unsigned m_fired;
+    int m_left;
+    char m_message[512];
+    size_t m_message_length;
+
+    int pack_index(const char * name);
+    bool grow_state(uint32_t rules_size);
+    void add_rate(unsigned pack, AlertSample * sample);
+    void fire(const AlertRule & rule, unsigned pack, const AlertSample & sample);
+    uint32_t table_hash() const;
+public:
+    AlertEngine();
+    ~AlertEngine();
+    bool add_rule(const char * line);
+    int load(const char * path);
+    void add_defaults(int low_threshold, int health_threshold, int cooldown);
+    uint32_t num_rules() const {return m_num_rules;};
+    void load_state(const char * path);
+    void save_state(const char * path);
+    unsigned evaluate(const char * pack, const AlertSample & sample, time_t now);
+    unsigned take_fired(int * left, const char ** message);
+};
+
+#endif
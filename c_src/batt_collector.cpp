@@ -0,0 +1,294 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Collects the history uploaded by the batt_checkers of a fleet into one
+ * store (see fleet_store.h), and answers fleet wide queries on it.
+ *
+ * Uploads are batches of samples, compressed as history segments, one per
+ * connection (see fleet.h). All the connections are served by one thread
+ * with epoll: an upload is small and stored with two appends, so there's
+ * nothing to gain from more, and it keeps the store single writer.
+ *
+ * Usage: batt_collector [-d store] -l address [-l address]...
+ *        batt_collector [-d store] -q stats|rates
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "fleet.h"
+#include "fleet_store.h"
+
+#define MAX_LISTEN 8
+
+/* Secs a connection has to send its upload before it is dropped */
+#define CONN_TIMEOUT 30
+
+#define MAX_EVENTS 256
+
+/* First buffer for an upload, doubled as more of it arrives */
+#define INITIAL_BUF 4096
+
+/* Marks a listening socket in the epoll data */
+#define LISTENER (1ull << 32)
+
+/**
+ * An upload being received
+ */
+struct Connection
+{
+    bool open;
+    time_t start;
+    size_t length;              /* Received so far */
+    size_t expected;            /* The whole message, 0 until the header is in */
+    size_t size;                /* Of buf */
+    uint8_t header[FLEET_HEADER_SIZE];
+    uint8_t * buf;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int)
+{
+    stopping = 1;
+}
+
+/**
+ * Allow as many connections as the hard limit on open files does
+ *
+ * @return The limit
+ */
+static int raise_fd_limit(void)
+{
+    struct rlimit lim;
+    if(getrlimit(RLIMIT_NOFILE, &lim) != 0) {
+        return 1024;
+    }
+    if(lim.rlim_cur < lim.rlim_max) {
+        lim.rlim_cur = lim.rlim_max;
+        if(setrlimit(RLIMIT_NOFILE, &lim) != 0) {
+            getrlimit(RLIMIT_NOFILE, &lim);
+        }
+    }
+    return (lim.rlim_cur == RLIM_INFINITY) || (lim.rlim_cur > (1 << 20))
+        ? (1 << 20) : lim.rlim_cur;
+}
+
+/**
+ * Reply to an upload (if reply isn't 0) and close the connection
+ */
+static void finish(Connection * conns, int fd, char reply)
+{
+    if(reply) {
+        send(fd, &reply, 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+    }
+    close(fd);
+    free(conns[fd].buf);
+    memset(&conns[fd], 0, sizeof(conns[fd]));
+}
+
+/**
+ * Accept all the waiting connections
+ */
+static void accept_all(int epfd, int listen_fd, Connection * conns, int max_fds)
+{
+    int fd;
+    while((fd = accept4(listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = fd;
+        if((fd >= max_fds) || (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) != 0)) {
+            close(fd);
+            continue;
+        }
+        memset(&conns[fd], 0, sizeof(conns[fd]));
+        conns[fd].open = true;
+        conns[fd].start = time(NULL);
+    }
+}
+
+/**
+ * Read what has arrived on a connection, storing the upload once it is all
+ * in. The buffer grows with what has arrived rather than being the size the
+ * header claims, so idle connections can't tie up memory.
+ *
+ * @return 1 if an upload was stored, -1 if one was rejected, 0 if neither
+ */
+static int receive(FleetStore & store, Connection * conns, int fd)
+{
+    Connection & conn = conns[fd];
+    while(true) {
+        if(conn.expected && (conn.length == conn.size)) {
+            const size_t size = 2 * conn.size < conn.expected ? 2 * conn.size
+                : conn.expected;
+            uint8_t * buf = static_cast<uint8_t *>(realloc(conn.buf, size));
+            if(!buf) {
+                finish(conns, fd, FLEET_REJECTED);
+                return -1;
+            }
+            conn.buf = buf;
+            conn.size = size;
+        }
+        uint8_t * dest = conn.expected ? conn.buf : conn.header;
+        const size_t want = (conn.expected ? conn.size : FLEET_HEADER_SIZE)
+            - conn.length;
+        const ssize_t got = read(fd, dest + conn.length, want);
+        if(got <= 0) {
+            if((got < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+                return 0;
+            }
+            finish(conns, fd, 0);
+            return 0;
+        }
+        conn.length += got;
+
+        if(!conn.expected && (conn.length == FLEET_HEADER_SIZE)) {
+            const long length = fleet_message_length(conn.header);
+            conn.size = length < INITIAL_BUF ? length : INITIAL_BUF;
+            conn.buf = length > 0 ? static_cast<uint8_t *>(malloc(conn.size)) : NULL;
+            if(!conn.buf) {
+                finish(conns, fd, FLEET_REJECTED);
+                return -1;
+            }
+            memcpy(conn.buf, conn.header, FLEET_HEADER_SIZE);
+            conn.expected = length;
+        }
+        if(conn.expected && (conn.length == conn.expected)) {
+            FleetUpload upload;
+            const bool stored = fleet_decode(conn.buf, conn.length, &upload)
+                && store.append(upload);
+            finish(conns, fd, stored ? FLEET_STORED : FLEET_REJECTED);
+            return stored ? 1 : -1;
+        }
+    }
+}
+
+/**
+ * Drop the connections that have taken too long
+ */
+static void drop_stale(Connection * conns, int max_fds, time_t now)
+{
+    for(int fd = 0; fd < max_fds; fd++) {
+        if(conns[fd].open && (now - conns[fd].start > CONN_TIMEOUT)) {
+            finish(conns, fd, 0);
+        }
+    }
+}
+
+/**
+ * Serve uploads until told to stop
+ */
+static int serve(const char * dir, const char * addrs[], int num_addrs)
+{
+    FleetStore store(dir);
+    const int max_fds = raise_fd_limit();
+    Connection * conns = static_cast<Connection *>(calloc(max_fds, sizeof(Connection)));
+    const int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if(!conns || (epfd < 0)) {
+        fprintf(stderr, "Failed to start: %s\n", strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for(int i = 0; i < num_addrs; i++) {
+        const int fd = fleet_listen(addrs[i]);
+        struct epoll_event event;
+        event.events = EPOLLIN;
+        event.data.u64 = LISTENER | fd;
+        if((fd < 0) || (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) != 0)) {
+            fprintf(stderr, "Can't listen on %s: %s\n", addrs[i], strerror(errno));
+            return EXIT_FAILURE;
+        }
+        printf("Listening on %s\n", addrs[i]);
+    }
+    fflush(stdout);
+
+    signal(SIGTERM, stop);
+    signal(SIGINT, stop);
+    unsigned long long stored = 0;
+    unsigned long long rejected = 0;
+    time_t last_sweep = time(NULL);
+    while(!stopping) {
+        struct epoll_event events[MAX_EVENTS];
+        const int num = epoll_wait(epfd, events, MAX_EVENTS, 1000);
+        for(int i = 0; i < num; i++) {
+            const int fd = static_cast<int>(events[i].data.u64 & 0xffffffff);
+            if(events[i].data.u64 & LISTENER) {
+                accept_all(epfd, fd, conns, max_fds);
+            }
+            else if(conns[fd].open) {
+                const int result = receive(store, conns, fd);
+                stored += result > 0;
+                rejected += result < 0;
+            }
+        }
+        const time_t now = time(NULL);
+        if(now - last_sweep >= CONN_TIMEOUT) {
+            drop_stale(conns, max_fds, now);
+            last_sweep = now;
+        }
+    }
+    printf("Stored %llu rejected %llu\n", stored, rejected);
+    for(int i = 0; i < num_addrs; i++) {
+        if(strchr(addrs[i], '/')) {
+            unlink(addrs[i]);
+        }
+    }
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, const char * argv[])
+{
+    const char * store = FLEET_STORE;
+    const char * query = NULL;
+    const char * addrs[MAX_LISTEN];
+    int num_addrs = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if((argv[i][0] == '-') && (i + 1 < argc)) {
+            switch(argv[i][1])
+            {
+                case 'd':
+                    i++;
+                    store = argv[i];
+                    break;
+
+                case 'l':
+                    i++;
+                    if(num_addrs < MAX_LISTEN) {
+                        addrs[num_addrs++] = argv[i];
+                    }
+                    break;
+
+                case 'q':
+                    i++;
+                    query = argv[i];
+                    break;
+            }
+        }
+    }
+
+    if(query) {
+        if(!fleet_store_query(store, query, stdout)) {
+            fprintf(stderr, "Unknown query '%s'\n", query);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+    if(num_addrs == 0) {
+        fprintf(stderr, "Usage: %s [-d store] -l address [-l address]...\n"
+                "       %s [-d store] -q stats|rates\n", argv[0], argv[0]);
+        return EXIT_FAILURE;
+    }
+    return serve(store, addrs, num_addrs);
+}
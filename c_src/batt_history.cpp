@@ -0,0 +1,147 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Dump the whole battery history, the sealed segments oldest first and then
+ * the live data.log, in the data.log format.
+ *
+ * Usage: batt_history [-l log] [-d segment dir] [-s since]
+ */
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "history.h"
+
+#define CACHE_LOG  "/var/cache/batt_checker/data.log"
+#define HISTORY_DIR "/var/cache/batt_checker/history"
+
+/**
+ * Read a whole file
+ *
+ * @param[in] path The file
+ * @param[out] length Set to its size
+ *
+ * @return The contents (free() it), or NULL
+ */
+static uint8_t * read_file(const char * path, size_t * length)
+{
+    FILE * fp = fopen(path, "r");
+    if(!fp) {
+        return NULL;
+    }
+    uint8_t * data = NULL;
+    struct stat st;
+    if((fstat(fileno(fp), &st) == 0) && (st.st_size > 0)) {
+        data = static_cast<uint8_t *>(malloc(st.st_size));
+        if(data && (fread(data, 1, st.st_size, fp) == static_cast<size_t>(st.st_size))) {
+            *length = st.st_size;
+        }
+        else {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fp);
+    return data;
+}
+
+/**
+ * Print the samples of the sealed segments
+ *
+ * @param[in] seg_dir The segment directory
+ * @param[in] since Skip samples before this real time
+ */
+static void dump_segments(const char * seg_dir, int64_t since)
+{
+    struct dirent ** entries;
+    const int num = history_scan_segments(seg_dir, &entries);
+    if(num < 0) {
+        return;
+    }
+    for(int i = 0; i < num; i++) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", seg_dir, entries[i]->d_name);
+        free(entries[i]);
+
+        size_t length = 0;
+        uint8_t * data = read_file(path, &length);
+        uint32_t count;
+        int64_t first_real, last_real;
+        if(!data || !history_segment_info(data, length, &count, &first_real, &last_real)) {
+            fprintf(stderr, "Bad segment %s\n", path);
+        }
+        else if(last_real >= since) {
+            HistoryReader reader;
+            reader.open(data, length);
+            HistorySample sample;
+            char line[256];
+            while(reader.next(&sample)) {
+                if(sample.real_time >= since) {
+                    history_format_line(sample, line, sizeof(line));
+                    fputs(line, stdout);
+                }
+            }
+        }
+        free(data);
+    }
+    free(entries);
+}
+
+/**
+ * Print the live log
+ *
+ * @param[in] log_path The log
+ * @param[in] since Skip samples before this real time
+ */
+static void dump_log(const char * log_path, int64_t since)
+{
+    FILE * fp = fopen(log_path, "r");
+    if(fp) {
+        char line[256];
+        while(fgets(line, sizeof(line), fp)) {
+            HistorySample sample;
+            if(history_parse_line(line, &sample) && (sample.real_time >= since)) {
+                fputs(line, stdout);
+            }
+        }
+        fclose(fp);
+    }
+}
+
+int main(int argc, const char * argv[])
+{
+    const char * log_path = CACHE_LOG;
+    const char * seg_dir = HISTORY_DIR;
+    int64_t since = 0;
+
+    for(int i = 1; i < argc; i++) {
+        if((argv[i][0] == '-') && (i + 1 < argc)) {
+            switch(argv[i][1])
+            {
+                case 'l':
+                    i++;
+                    log_path = argv[i];
+                    break;
+
+                case 'd':
+                    i++;
+                    seg_dir = argv[i];
+                    break;
+
+                case 's':
+                    i++;
+                    since = strtoll(argv[i], NULL, 10);
+                    break;
+            }
+        }
+    }
+    dump_segments(seg_dir, since);
+    dump_log(log_path, since);
+    return EXIT_SUCCESS;
+}
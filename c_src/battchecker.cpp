@@ -0,0 +1,365 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * The C ABI of libbattchecker.so, a thin layer over the classes batt_checker
+ * uses. The history is decoded into one anonymous mapping holding a column
+ * per field, which callers (e.g. Python through ctypes) view in place rather
+ * than copying out a row at a time.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "battchecker.h"
+#include "battery_info.h"
+#include "battery_health.h"
+#include "charge_curve.h"
+#include "history.h"
+
+/* Shortest possible data.log line, for sizing the columns */
+#define MIN_LINE_LENGTH 12
+
+/**
+ * Decoded history
+ */
+struct bc_history
+{
+    void * map;
+    size_t map_size;
+    size_t first;               /* First sample at or after since */
+    size_t count;               /* Samples decoded, including before first */
+    int64_t * real_time;
+    int64_t * up_time;
+    uint8_t * status;
+    int64_t * capacity;
+    int64_t * volts;
+};
+
+/**
+ * A segment file mapped in to memory
+ */
+struct MappedSegment
+{
+    const uint8_t * data;
+    size_t length;
+};
+
+int bc_abi_version(void)
+{
+    return BC_ABI_VERSION;
+}
+
+/**
+ * Read the state of a battery, with the predictions batt_checker makes
+ *
+ * @param[in] name The battery, as in /sys/class/power_supply (e.g. BAT0)
+ * @param[in] health_threshold Health (in %) at which to replace it
+ * @param[out] battery The state
+ *
+ * @return 0 if present, -1 if not
+ */
+int bc_read_battery(const char * name, int health_threshold,
+        struct bc_battery * battery)
+{
+    memset(battery, 0, sizeof(*battery));
+    BatteryInfo info(name);
+    info.check_battery();
+    if(!info.is_present()) {
+        return -1;
+    }
+
+    battery->present = 1;
+    battery->charging = info.is_charging();
+    battery->discharging = info.is_discharging();
+    battery->fullness = info.calc_fullness(MicroJoules());
+    battery->mins_left = info.calc_left(MicroJoules());
+    battery->mins_to_full = -1;
+    if(info.is_charging()) {
+        ChargeCurve curve(name);
+        curve.load();
+        battery->mins_to_full = curve.calc_time_to_full(
+                info.get_current_capacity(), info.get_last_full_capacity(),
+                info.get_rate());
+    }
+
+    BatteryHealth health(name);
+    health.load();
+    battery->health = static_cast<int32_t>(health.calc_health() * 10000 + 0.5f);
+    battery->health_days_left = health.calc_days_left(health_threshold / 100.0f);
+    battery->milli_cycles = health.get_micro_cycles() / 1000;
+
+    battery->max_capacity = info.get_max_capacity().micro();
+    battery->last_full_capacity = info.get_last_full_capacity().micro();
+    battery->current_capacity = info.get_current_capacity().micro();
+    battery->volts = info.get_volts().micro();
+    battery->rate = info.get_rate().micro();
+    return 0;
+}
+
+/**
+ * Map the segments in to memory
+ *
+ * @param[in] seg_dir The segment directory
+ * @param[out] segments Set to the list of mapped segments, free() it
+ * @param[out] samples Set to the most samples they can hold
+ *
+ * @return The number of segments
+ */
+static int map_segments(const char * seg_dir, MappedSegment ** segments,
+        size_t * samples)
+{
+    *segments = NULL;
+    *samples = 0;
+    struct dirent ** entries;
+    const int num = history_scan_segments(seg_dir, &entries);
+    if(num <= 0) {
+        return 0;
+    }
+    int mapped = 0;
+    *segments = static_cast<MappedSegment *>(malloc(sizeof(MappedSegment) * num));
+    for(int i = 0; i < num; i++) {
+        char path[1024];
+        snprintf(path, sizeof(path), "%s/%s", seg_dir, entries[i]->d_name);
+        free(entries[i]);
+        const int fd = *segments ? open(path, O_RDONLY) : -1;
+        if(fd < 0) {
+            continue;
+        }
+        struct stat st;
+        if((fstat(fd, &st) == 0) && (st.st_size > 0)) {
+            void * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            uint32_t count;
+            int64_t first_real, last_real;
+            if(data == MAP_FAILED) {
+                /* Skip it */
+            }
+            else if(!history_segment_info(static_cast<const uint8_t *>(data),
+                        st.st_size, &count, &first_real, &last_real)) {
+                munmap(data, st.st_size);
+            }
+            else {
+                (*segments)[mapped].data = static_cast<const uint8_t *>(data);
+                (*segments)[mapped].length = st.st_size;
+                *samples += count;
+                mapped++;
+            }
+        }
+        close(fd);
+    }
+    free(entries);
+    return mapped;
+}
+
+/**
+ * Decode the whole history, the sealed segments then the live log, into
+ * columns. The columns are in time order. The live log is locked as
+ * history_seal() locks it, so a seal can't move samples between the two
+ * while they are read.
+ *
+ * @param[in] log_path The live log, NULL for the default
+ * @param[in] seg_dir The segment directory, NULL for the default
+ * @param[in] since Leave out samples before this real time
+ *
+ * @return The history, or NULL (errno set) if it can't be decoded
+ */
+struct bc_history * bc_history_open(const char * log_path,
+        const char * seg_dir, int64_t since)
+{
+    if(!log_path) {
+        log_path = CACHE_LOG;
+    }
+    if(!seg_dir) {
+        seg_dir = HISTORY_DIR;
+    }
+    bc_history * history = static_cast<bc_history *>(calloc(1, sizeof(bc_history)));
+    if(!history) {
+        return NULL;
+    }
+
+    FILE * fp = fopen(log_path, "r");
+    if(fp) {
+        flock(fileno(fp), LOCK_SH);
+    }
+    MappedSegment * segments;
+    size_t samples;
+    const int num_segments = map_segments(seg_dir, &segments, &samples);
+    struct stat st;
+    if(fp && (fstat(fileno(fp), &st) == 0)) {
+        samples += st.st_size / MIN_LINE_LENGTH + 1;
+    }
+
+    /* The four 64 bit columns then status, pages only used are touched */
+    const size_t page = sysconf(_SC_PAGESIZE);
+    history->map_size = ((4 * sizeof(int64_t) + 1) * samples + page) / page * page;
+    history->map = mmap(NULL, history->map_size, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(history->map == MAP_FAILED) {
+        const int error = errno;
+        for(int i = 0; i < num_segments; i++) {
+            munmap(const_cast<uint8_t *>(segments[i].data), segments[i].length);
+        }
+        free(segments);
+        if(fp) {
+            fclose(fp);
+        }
+        free(history);
+        errno = error;
+        return NULL;
+    }
+    int64_t * columns = static_cast<int64_t *>(history->map);
+    history->real_time = columns;
+    history->up_time = columns + samples;
+    history->capacity = columns + 2 * samples;
+    history->volts = columns + 3 * samples;
+    history->status = reinterpret_cast<uint8_t *>(columns + 4 * samples);
+
+    for(int i = 0; i < num_segments; i++) {
+        uint32_t count;
+        int64_t first_real, last_real;
+        history_segment_info(segments[i].data, segments[i].length, &count,
+                &first_real, &last_real);
+        if((last_real >= since) && (history->count < samples)) {
+            HistoryColumns columns;
+            columns.real_time = history->real_time + history->count;
+            columns.up_time = history->up_time + history->count;
+            columns.status = history->status + history->count;
+            columns.capacity = history->capacity + history->count;
+            columns.volts = history->volts + history->count;
+            HistoryReader reader;
+            reader.open(segments[i].data, segments[i].length);
+            history->count += reader.read_columns(columns, samples - history->count);
+        }
+        munmap(const_cast<uint8_t *>(segments[i].data), segments[i].length);
+    }
+    free(segments);
+
+    if(fp) {
+        char line[256];
+        HistorySample sample;
+        while((history->count < samples) && fgets(line, sizeof(line), fp)) {
+            if(history_parse_line(line, &sample)) {
+                const size_t i = history->count++;
+                history->real_time[i] = sample.real_time;
+                history->up_time[i] = sample.up_time;
+                history->status[i] = sample.status;
+                history->capacity[i] = sample.capacity.micro();
+                history->volts[i] = sample.volts.micro();
+            }
+        }
+        fclose(fp);
+    }
+
+    while((history->first < history->count)
+            && (history->real_time[history->first] < since)) {
+        history->first++;
+    }
+    return history;
+}
+
+/**
+ * @return The number of samples in the history
+ */
+size_t bc_history_count(const struct bc_history * history)
+{
+    return history->count - history->first;
+}
+
+/**
+ * Get a column of the history. It stays valid until bc_history_close().
+ *
+ * @param[in] history The history
+ * @param[in] column Which column (enum bc_column)
+ *
+ * @return The column, bc_history_count() values, NULL if not a column
+ */
+const void * bc_history_column(const struct bc_history * history, int column)
+{
+    switch(column) {
+        case BC_REAL_TIME:
+            return history->real_time + history->first;
+
+        case BC_UP_TIME:
+            return history->up_time + history->first;
+
+        case BC_STATUS:
+            return history->status + history->first;
+
+        case BC_CAPACITY:
+            return history->capacity + history->first;
+
+        case BC_VOLTS:
+            return history->volts + history->first;
+    }
+    return NULL;
+}
+
+/**
+ * Work out the worst and mean discharge rates, from pairs of discharging
+ * samples with no suspend between them. What batt_checker uses to predict
+ * when to check next.
+ *
+ * @param[in] history The history
+ * @param[out] rates The rates
+ *
+ * @return 0 if there was enough history, -1 if not
+ */
+int bc_history_rates(const struct bc_history * history, struct bc_rates * rates)
+{
+    memset(rates, 0, sizeof(*rates));
+    HistoryColumns columns;
+    columns.real_time = history->real_time;
+    columns.up_time = history->up_time;
+    columns.status = history->status;
+    columns.capacity = history->capacity;
+    columns.volts = history->volts;
+    int64_t energy = 0;
+    for(size_t i = history->first + 1; i < history->count; i++) {
+        int64_t used, period;
+        if(history_discharge_rate(columns, i, &used, &period)) {
+            const int64_t rate = used / period;
+            if(rate > rates->worst) {
+                rates->worst = rate;
+            }
+            energy += used;
+            rates->secs += period;
+        }
+    }
+    if(rates->secs == 0) {
+        return -1;
+    }
+    rates->mean = energy / rates->secs;
+    return 0;
+}
+
+void bc_history_close(struct bc_history * history)
+{
+    if(history) {
+        if(history->map) {
+            munmap(history->map, history->map_size);
+        }
+        free(history);
+    }
+}
+
+/**
+ * Seal the live log into segments, as batt_checker does once it is big
+ *
+ * @return 0 if sealed, -1 if not
+ */
+int bc_history_seal(const char * log_path, const char * seg_dir)
+{
+    return history_seal(log_path ? log_path : CACHE_LOG,
+            seg_dir ? seg_dir : HISTORY_DIR) ? 0 : -1;
+}
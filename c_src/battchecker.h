@@ -0,0 +1,94 @@
+#ifndef _BATTCHECKER_H_
+#define _BATTCHECKER_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * The C ABI of libbattchecker.so, the battery reading, prediction and
+ * history code that batt_checker itself uses, for other programs (and the
+ * Python side, through ctypes).
+ *
+ * Only plain C types cross the ABI. Values are fixed point micro-units as
+ * int64_t. Structures are only ever added to at the end, and a caller can
+ * check bc_abi_version() to see what it has.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define BC_ABI_VERSION 1
+
+#define BC_EXPORT __attribute__((visibility("default")))
+
+/**
+ * The state of one battery
+ */
+struct bc_battery
+{
+    int32_t present;
+    int32_t charging;
+    int32_t discharging;
+    int32_t fullness;           /* % of last full, -1 if unknown */
+    int32_t mins_left;          /* Until flat, 999 if not discharging */
+    int32_t mins_to_full;       /* From the learnt charge curve, -1 if not charging */
+    int32_t health;             /* Last full as % of design * 100 */
+    int32_t health_days_left;   /* Until below the threshold, -1 if unknown */
+    int64_t milli_cycles;       /* Equivalent full cycles * 1000 */
+    int64_t max_capacity;       /* uJ */
+    int64_t last_full_capacity; /* uJ */
+    int64_t current_capacity;   /* uJ */
+    int64_t volts;              /* uV */
+    int64_t rate;               /* uW */
+};
+
+/* The columns of the history */
+enum bc_column
+{
+    BC_REAL_TIME = 0,           /* int64_t secs */
+    BC_UP_TIME = 1,             /* int64_t secs */
+    BC_STATUS = 2,              /* uint8_t, 0 charging, 1 discharging, 2 idle */
+    BC_CAPACITY = 3,            /* int64_t uJ */
+    BC_VOLTS = 4                /* int64_t uV */
+};
+
+/**
+ * Discharge rates worked out from the history
+ */
+struct bc_rates
+{
+    int64_t worst;              /* uW */
+    int64_t mean;               /* uW */
+    int64_t secs;               /* Discharge time they cover */
+};
+
+struct bc_history;
+
+BC_EXPORT int bc_abi_version(void);
+
+BC_EXPORT int bc_read_battery(const char * name, int health_threshold,
+        struct bc_battery * battery);
+
+BC_EXPORT struct bc_history * bc_history_open(const char * log_path,
+        const char * seg_dir, int64_t since);
+BC_EXPORT size_t bc_history_count(const struct bc_history * history);
+BC_EXPORT const void * bc_history_column(const struct bc_history * history,
+        int column);
+BC_EXPORT int bc_history_rates(const struct bc_history * history,
+        struct bc_rates * rates);
+BC_EXPORT void bc_history_close(struct bc_history * history);
+
+BC_EXPORT int bc_history_seal(const char * log_path, const char * seg_dir);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -5,180 +5,77 @@
  */
 
 #include <dirent.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <time.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 
+#include "units.h"
+#include "alerts.h"
 #include "battery_info.h"
+#include "battery_health.h"
+#include "charge_curve.h"
+#include "history.h"
+#include "proc_energy.h"
+#include "raw_io.h"
+#include "uploader.h"
 
-#define SYS_PREFIX "/sys/class/power_supply"
-#define CACHE_LOG  "/var/cache/batt_checker/data.log"
-#define WORST_RATE "/var/cache/batt_checker/worst_discharge_rate"
-#define MEAN_RATE  "/var/cache/batt_checker/mean_discharge_rate"
+#define TOP_ENERGY ROOT_PREFIX "/var/cache/batt_checker/top_energy"
 
-/**
- * Close all file descriptors accept stdin, stdout and stderr
- * Used after a fork() so that child only has access to the
- * standard IO
- */
-static void close_all_fds(void)
-{
-    const int maxFd = sysconf(_SC_OPEN_MAX);
-    int i;
-    for(i = 3; i <= maxFd; i++) {
-        close(i);
-    }
-}
-
-/**
- * Redirect stdout & stderr to /dev/null, this is used to
- * detach from the controlling terminal
- */
-static void redirect_out(void)
-{
-    const int fd_null_out = open("/dev/null", O_RDONLY);
-    if(fd_null_out > 0) {
-	dup2(fd_null_out, 1);
-	dup2(fd_null_out, 2);
-
-        close(fd_null_out);
-    }
-}
-
-/**
- * Redirect stdin & from /dev/null, this is used to detach
- * from the controlling terminal
- */
-static void redirect_in(void)
-{
-    const int fd_null_in = open("/dev/null", O_WRONLY);
-    if(fd_null_in > 0) {
-        dup2(fd_null_in, 0);
-        close(fd_null_in);
-    }
-}
 /**
  * Generate an alert dialog to indicate battery is getting low.
- * This is done by forking another process to do the alert.
+ * This is done by spawning another process to do the alert, which isn't
+ * waited for, so a slow one doesn't hold up the next sample. SIGCHLD is
+ * ignored so the kernel reaps it.
  *
  * @param[in] left Estimated time left until battery is flat (in mins)
- * @param[in] app_argv The App plus args that does the alert dialog
+ * @param[in] message What fired
+ * @param[in] app_argv The App plus args that does the alert dialog, NULL
+ *      for none
  */
-static void alert(int left, const char * app_argv[])
+static void alert(int left, const char * message, const char * app_argv[])
 {
-    printf("Alert Left =%i\n", left);
-
-    const pid_t pid1 = fork();
-    if(pid1 == 0) {     /* Child */
-        /* Group child and any grand children under the same process group */
-        if(setsid() < 0) {
-            fprintf(stderr, "Failed to setsid\n");
-        }
-
-        redirect_out();
-        redirect_in();
-        close_all_fds();
-
-        const pid_t pid2 = fork();
-        if(pid2 == 0) {
-            execvp(app_argv[0], const_cast<char **>(app_argv));
-            exit(EXIT_FAILURE);
-        }
-        else {
-            exit(EXIT_SUCCESS);
-        }
-    }
-    else if(pid1 > 0) {
-        int status;
-        wait(&status);
+    out_printf("Alert Left =%i %s\n", left, message);
+    out_flush();
+    if(!app_argv) {
+        return;
     }
-}
-
-
-/**
- * Convert uW to W
- *
- * @param[in] value Value in micro-watts
- *
- * @return Conversion to Watts
- */
-static float uwatts2watts(int value)
-{
-    return value / 1000000.0;
-}
-
-/**
- * Convert uWh to Joules
- *
- * @param[in] value Value in micro-watt-hours
- *
- * @return Conversion to Joules
- */
-static float uwatthr2joules(int value)
-{
-    return (value * 60.0 * 60.0)/1000000.0;
-}
-
-/**
- * Convert uAh to Joules
- *
- * @param[in] value Value in micro-amp-hours
- * @param[in] volts The voltage
- *
- * @return Conversion to Joules
- */
-static float uamphr2joules(int value, float volts)
-{
-    return uwatthr2joules(value * volts);
-}
-
-/**
- * Convert uV to V
- *
- * @param[in] value Value in micro-volts
- *
- * @return Conversion to Volts
- */
-static float uvolts2volts(int value)
-{
-    return value / 1000000.0;
-}
 
-/**
- * read proc file system
- *
- * @param[in] base The battery info directory in the proc filesystem
- * @param[in] file The file in the base directory
- * @param[out] result The buffer to put contents of the file after reading it
- * @param[out] maxlen The maximum size of buffer
- *
- * @return The actual number of bytes place in result buffer
- */
-static size_t read_sys(const char * base, const char * file, char * result, size_t maxlen) {
-    size_t length = 0;
-    char pathname[1024];
-    snprintf(pathname, sizeof(pathname), "%s/%s/%s", SYS_PREFIX, base, file);
-//    printf("pathname='%s'\n", pathname);
-    const int f = open(pathname, O_RDONLY);
-    if(f) {
-        length = read(f, result, maxlen-1);
-        while((length > 0) && (result[length-1] == '\n')) {
-            length--;
-        }
-//        printf("reading..%u %u\n", length, maxlen);
-//        perror("");
-        close(f);
-    }
-    result[length] ='\0';
-    return length;
+    /* Detached from the checker, with only the standard IO on /dev/null,
+     * and SIGCHLD back to the default for any children of its own */
+    posix_spawnattr_t attr;
+    posix_spawnattr_init(&attr);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSID | POSIX_SPAWN_SETSIGDEF);
+    sigset_t sigdef;
+    sigemptyset(&sigdef);
+    sigaddset(&sigdef, SIGCHLD);
+    posix_spawnattr_setsigdefault(&attr, &sigdef);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 0, "/dev/null", O_RDONLY, 0);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, 1, 2);
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 34))
+    posix_spawn_file_actions_addclosefrom_np(&actions, 3);
+#endif
+
+    pid_t pid;
+    const int err = posix_spawnp(&pid, app_argv[0], &actions, &attr,
+            const_cast<char **>(app_argv), environ);
+    if(err != 0) {
+        err_printf("Failed to run %s: %s\n", app_argv[0], strerror(err));
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
 }
 
 /**
@@ -194,319 +91,16 @@ static int to_int(const char * value)
 }
 
 /**
- * The BatteryInfo constructor
- */
-BatteryInfo::BatteryInfo(const char * name)
-{
-    memset(this, 0, sizeof(*this));
-    m_name = name;
-}
-
-/**
- * Read and refresh the is battery present flag
- */
-void BatteryInfo::read_type()
-{
-    char result[256];
-    int status = read_sys(m_name, "type", result, sizeof(result));
-    if(status > 0) {
-        if(strcasecmp(result, "mains") == 0) {
-            m_present = false;
-        }
-        else if(strcasecmp(result, "battery") == 0) {
-            status = read_sys(m_name, "present", result, sizeof(result));
-            if(status > 0) {
-                m_present = to_int(result) ? true : false;
-            }
-            else {
-                m_present = false;
-            }
-        }
-        else {
-            fprintf(stderr, "Invalid type '%s'\n", result);
-            m_present = false;
-        }
-    }
-    else {
-        m_present = false;
-    }
-}
-
-/**
- * Convert text charging state value into two bool values
- */
-void BatteryInfo::read_charging_state()
-{
-    char result[256];
-
-    const int status = read_sys(m_name, "status", result, sizeof(result));
-    if(status > 0) {
-        if(strcmp(result, "Charging") == 0) {
-            m_charging = true;
-            m_discharging = false;
-        }
-        else if(strcmp(result, "Discharging") == 0) {
-            m_discharging = true;
-            m_charging = false;
-        }
-        else if( (strcmp(result, "Unknown") != 0)
-                && (strcmp(result, "Full") != 0)) {
-            fprintf(stderr, "State = '%s'", result);
-            exit(EXIT_FAILURE);
-        }
-        else {
-            m_charging= false;
-            m_discharging = false;
-        }
-    }
-}
-
-
-
-void BatteryInfo::read_voltage()
-{
-    char result[256];
-    int status = read_sys(m_name, "voltage_now", result, sizeof(result));
-    if(status > 0) {
-        m_volts = uvolts2volts(to_int(result));
-
-        status = read_sys(m_name, "voltage_min_design", result,
-                sizeof(result));
-        if(status > 0) {
-            float min_voltage = uvolts2volts(to_int(result));
-            if(min_voltage > 100) {
-                /* Some times volts are in pico-volts, err.. */
-                min_voltage /= 1000;
-            }
-            if(m_volts < 0.5 * min_voltage) {
-                printf("voltage reading is probably broken\n");
-                m_volts = min_voltage;
-            }
-        }
-    }
-}
-
-void BatteryInfo::read_capacity()
-{
-    char result[256];
-    int status = read_sys(m_name, "energy_full", result, sizeof(result));
-    if(status > 0) {
-        m_last_full_capacity = uwatthr2joules(to_int(result));
-    }
-    else {
-        status = read_sys(m_name, "charge_full", result, sizeof(result));
-        if(status > 0) {
-            m_last_full_capacity = uamphr2joules(to_int(result),
-                    m_volts);
-        }
-    }
-
-    status = read_sys(m_name, "energy_full_design", result, sizeof(result));
-    if(status > 0) {
-        m_max_capacity = uwatthr2joules(to_int(result));
-    }
-    else {
-        status = read_sys(m_name, "charge_full_design", result,
-                sizeof(result));
-        if(status > 0) {
-            m_max_capacity = uamphr2joules(to_int(result), m_volts);
-        }
-    }
-
-    status = read_sys(m_name, "energy_now", result, sizeof(result));
-    if(status > 0) {
-        m_current_capacity = uwatthr2joules(to_int(result));
-    }
-    else {
-        status = read_sys(m_name, "charge_now", result, sizeof(result));
-        if(status > 0) {
-           m_current_capacity = uamphr2joules(to_int(result),
-                    m_volts);
-        }
-    }
-
-    read_sys(m_name, "alarm", result, sizeof(result));
-    if(status > 0) {
-        m_min_capacity = uwatthr2joules(to_int(result));
-    }
-    else {
-        m_min_capacity = uamphr2joules(to_int(result),
-                m_volts);
-    }
-}
-
-void BatteryInfo::read_rate()
-{
-    char result[256];
-    int status = read_sys(m_name, "power_now", result, sizeof(result));
-    if(status > 0) {
-        m_rate = uwatts2watts(to_int(result));
-    }
-    else {
-        read_sys(m_name, "current_now", result, sizeof(result));
-        m_rate = uwatts2watts(to_int(result) * m_volts);
-    }
-}
-
-/**
- * Fill in the BatterInfo_t structure with information read from the proc
- * filesystem about battery name
- *
- * @param[out] info The Battery status
- */
-void BatteryInfo::check_battery()
-{
-    read_type();
-    if(!is_present()) {
-        return;
-    }
-
-    read_charging_state();
-    read_voltage();
-    read_capacity();
-    read_rate();
-}
-
-/**
- * Estimate in mins until battery reaches minimum charge
- *
- * @param[in] info The battery status
- * @param[in] min The minimum charge (in Joules)
- *
- * @return estimated time in minutes
- */
-int BatteryInfo::calc_left(float min) const
-{
-    if(is_discharging()) {
-        float left = m_current_capacity - min;
-        float mean_rate = m_rate;
-
-        if(mean_rate <= 0.0001) {
-            FILE * fp = fopen(MEAN_RATE,"r");
-            if(fp) {
-                char buf[512];
-                int got = fread(buf, sizeof(buf), 1, fp);
-                buf[got] = '\0';
-                fclose(fp);
-                mean_rate = strtof(buf, 0);
-            }
-        }
-        return static_cast<int>(left / mean_rate / 60.0 + 0.5);
-    }
-    return 999;
-}
-
-/**
- * Calculate part/total as a percentage
- *
- * @param[in] part (the numerator)
- * @param[in] total (the denomator)
- *
- * @return percentage or -1 if out of range
- */
-static int calc_percent(float part, float total)
-{
-    if(total > part) {
-        return static_cast<int>(part*100/total + 0.5);
-    }
-    return -1;
-}
-
-
-
-int BatteryInfo::calc_fullness(float min) const
-{
-    return calc_percent(m_current_capacity - min,
-                        m_last_full_capacity - min);
-}
-
-/**
- * Open the database that contains history of previous measurements
- * and calculate the worst case (minimum time) for when battery will
- * go below the min threshold.
- *
- * @param[in] info The battery status
- * @param[in] min The minimum charge (in Joules)
- *
- * @return estimated time in minutes
- */
-int BatteryInfo::calc_next_period(float min) const
-{
-    float worst_rate = 15;
-    float left = m_current_capacity - min;
-
-    FILE * fp = fopen(WORST_RATE,"r");
-    if(fp) {
-        char buf[512];
-        int got = fread(buf, sizeof(buf), 1, fp);
-        buf[got] = '\0';
-        fclose(fp);
-        worst_rate = strtof(buf, 0);
-    }
-    if(worst_rate < m_rate) {
-        worst_rate = m_rate;
-    }
-    return static_cast<int>(left / (60.0 * worst_rate) + 0.5);
-}
-
-/**
- * print info
+ * Tell the listener (the systray) the state: a "fullness [ALERT]" line, then
+ * the top-N energy table if there is one
  *
- * @param[in] info The battery status
+ * @param[in] sock The listener's socket
+ * @param[in] fullness The battery's charge in %
+ * @param[in] alert true if an alert fired
+ * @param[in] energy If not NULL, the energy attribution
  */
-void BatteryInfo::print_self() const
-{
-    if(!is_present()) {
-        printf("No battery\n");
-        return;
-    }
-
-    printf("Max      =%10.1f J (%3i%%)\n", m_max_capacity, 100);
-    printf("Last full=%10.1f J (%3i%%)\n", m_last_full_capacity,
-            calc_percent(m_last_full_capacity, m_max_capacity));
-    printf("Current  =%10.1f J (%3i%%)\n", m_current_capacity,
-            calc_percent(m_current_capacity, m_max_capacity));
-    printf("Min      =%10.1f J (%3i%%)\n", m_min_capacity,
-            calc_percent(m_min_capacity, m_max_capacity));
-
-    printf("volts=%.2f v\n", m_volts);
-
-//    info->m_min_capacity = 0
-    if(is_charging()) {
-        float left = m_last_full_capacity - m_current_capacity;
-        int minutes = static_cast<int>(left / m_rate / 60.0 + 0.5);
-        printf("Charging rate=%f J/s\n", m_rate);
-        printf( "%i mins left to reach last full\n", minutes);
-    }
-    if(is_discharging()) {
-        printf("Discharging rate=%f J/s\n", m_rate);
-        printf("%i mins left before flat\n", calc_left(0));
-    }
-}
-
-/**
- * Write to the history database
- *
- * @param[in] info The battery status
- */
-void BatteryInfo::open_database() const
-{
-    time_t real_time;
-    struct timespec up_time;
-    real_time = time(NULL);
-    clock_gettime(CLOCK_MONOTONIC, &up_time);
-
-    const char status = is_charging() ? '/' : is_discharging() ? '\\' : '-';
-
-    FILE * fp = fopen(CACHE_LOG,"a");
-    if(fp) {
-        fprintf(fp,"%lu\t%lu\t%c\t%9.1f\t%.2f\n",
-                  real_time, up_time.tv_sec, status, m_current_capacity, m_volts);
-        fclose(fp);
-    }
-}
-
-void signal_sock_listener(const char * sock, int fullness, bool alert)
+void signal_sock_listener(const char * sock, int fullness, bool alert,
+        const ProcEnergy * energy)
 {
     struct sockaddr_un addr;
     memset(&addr, 0, sizeof(addr));
@@ -516,40 +110,50 @@ void signal_sock_listener(const char * sock, int fullness, bool alert)
 
     const int fd = socket(AF_UNIX, SOCK_DGRAM, 0);
     if(fd >= 0) {
-        char msg[256];
-        snprintf(msg, sizeof(msg), "%i %s\n", fullness, alert ? "ALERT" : "");
+        char msg[1024];
+        const int length = snprintf(msg, sizeof(msg), "%i %s\n", fullness,
+                alert ? "ALERT" : "");
+        if(energy) {
+            energy->format_top(msg + length, sizeof(msg) - length);
+        }
 
-        const int length = sendto(fd, msg, strlen(msg), 0,
+        /* Not waiting for a listener that has stopped reading */
+        const int sent = sendto(fd, msg, strlen(msg), MSG_DONTWAIT,
                 reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
-        if(length < 0) {
-            perror("send");
+        if(sent < 0) {
+            err_printf("send: %s\n", strerror(errno));
         }
         else {
-            printf("Signalling '%s' %i\n", sock, length);
+            out_printf("Signalling '%s' %i\n", sock, sent);
         }
         close(fd);
     }
     else {
-        printf("Failed to create unix socket\n");
+        out_printf("Failed to create unix socket\n");
     }
 }
 
 /**
- * Check all the batteries, if one is about to expire before low_threshold
- * Alert the user
+ * Check all the batteries against the alert rules, and alert the user if any
+ * fire
  *
  * @param[in] argc Number of args for the alert program
  * @param[in] argv List of arguments for the alert program
- * @param[in] low_threshold In mins the threshold
+ * @param[in] alerts The alert rules
+ * @param[in] health_threshold Health (in %) at which to replace a battery
+ * @param[in] energy If not NULL, share the discharge across the processes
+ * @param[in] uploader If not NULL, queue the samples for the fleet collector,
+ *      uploading them once the alerts are dispatched
  *
  * @return The time in mins whn we should check again
  */
 static int check_batteries(int argc, const char * argv[], const char * sig_sock,
-        int low_threshold)
+        AlertEngine & alerts, int health_threshold, ProcEnergy * energy,
+        Uploader * uploader)
 {
-    int left = 9999;
     int fullness = 100;
     int next_period = 9999;
+    MicroWatts discharge_rate(0);
     DIR * dir = opendir(SYS_PREFIX);
     if(dir) {
         struct dirent * entry;
@@ -558,25 +162,70 @@ static int check_batteries(int argc, const char * argv[], const char * sig_sock,
                 BatteryInfo info(entry->d_name);
                 info.check_battery();
                 if(info.is_present()) {
-                    info.print_self();
-                    info.open_database();
-                    left = info.calc_left(0);
-                    fullness = info.calc_fullness(0);
-                    next_period = info.calc_next_period(0);
+                    ChargeCurve curve(entry->d_name);
+                    curve.load();
+                    if(curve.update(info)) {
+                        curve.save();
+                    }
+                    info.print_self(curve);
+                    HistorySample sample;
+                    info.get_sample(&sample);
+                    info.open_database(sample);
+                    if(uploader) {
+                        uploader->queue(info, entry->d_name, sample);
+                    }
+
+                    BatteryHealth health(entry->d_name);
+                    health.load();
+                    health.update(info, time(NULL));
+                    health.print_self(health_threshold / 100.0);
+                    health.save();
+
+                    fullness = info.calc_fullness(MicroJoules());
+                    next_period = info.calc_next_period(MicroJoules());
+                    if(info.is_discharging()) {
+                        discharge_rate += info.get_rate();
+                    }
+
+                    /* From what has been read already */
+                    AlertSample alert_sample;
+                    memset(&alert_sample, 0, sizeof(alert_sample));
+                    alert_sample.values[ALERT_PERCENT] = fullness;
+                    alert_sample.known = fullness >= 0 ? 1u << ALERT_PERCENT : 0;
+                    if(info.is_discharging()) {
+                        alert_sample.values[ALERT_MINUTES] = info.calc_left(MicroJoules());
+                        alert_sample.values[ALERT_RATE] = info.get_rate().micro();
+                        alert_sample.known |= (1u << ALERT_MINUTES) | (1u << ALERT_RATE);
+                    }
+                    const float health_fraction = health.calc_health();
+                    if(health_fraction > 0) {
+                        alert_sample.values[ALERT_HEALTH] = health_fraction * 1000000;
+                        alert_sample.known |= 1u << ALERT_HEALTH;
+                    }
+                    alerts.evaluate(entry->d_name, alert_sample, sample.real_time);
                 }
             }
         }
         closedir(dir);
     }
 
-    const bool need_to_alert = left < low_threshold ? true : false;
+    if(energy) {
+        energy->sample(discharge_rate);
+        energy->print_self();
+        energy->save(PROC_ENERGY_STATE);
+        energy->save_top(TOP_ENERGY);
+    }
+
+    int left;
+    const char * message;
+    const bool need_to_alert = alerts.take_fired(&left, &message) > 0;
 
     if(sig_sock) {
-        signal_sock_listener(sig_sock, fullness, need_to_alert);
+        signal_sock_listener(sig_sock, fullness, need_to_alert, energy);
     }
 
     if(need_to_alert) {
-        const char * app[10];
+        const char * app[11];
         char sLeft[20];
         int i;
         for(i = 0; (i < 8) && (i < argc); i++) {
@@ -584,12 +233,22 @@ static int check_batteries(int argc, const char * argv[], const char * sig_sock,
         }
         snprintf(sLeft,sizeof(sLeft),"%i", left);
         app[i++] = sLeft;
+        app[i++] = message;
         app[i] = NULL;
-        alert(left, app);
+        alert(left, message, argc > 0 ? app : NULL);
+    }
+
+    if(uploader) {
+        uploader->flush();
     }
     return next_period;
 }
 
+/**
+ * Only used if asked to attribute the discharge to processes
+ */
+static ProcEnergy proc_energy;
+
 /**
  * main entry point
  */
@@ -599,7 +258,13 @@ int main(int argc, const char * argv[])
     int time_to_respawn = 15;
     int reminder_period = 5;
     int low_threshold = 25;
+    int health_threshold = 80;
+    /* Only alert on health when asked to, as the checker never used to */
+    int health_alert = 0;
+    const char * rules = ALERT_RULES;
     const char * sig_sock = NULL;
+    const char * collector = NULL;
+    ProcEnergy * energy = NULL;
 
     for(i = 1; i < argc; i++) {
         if(argv[i][0] == '-') {
@@ -620,9 +285,30 @@ int main(int argc, const char * argv[])
                     low_threshold = to_int(argv[i]);
                     break;
 
+                case 'H':
+                    i++;
+                    health_threshold = to_int(argv[i]);
+                    health_alert = health_threshold;
+                    break;
+
                 case 's':
                     i++;
                     sig_sock = argv[i];
+                    break;
+
+                case 'e':
+                    energy = &proc_energy;
+                    break;
+
+                case 'c':
+                    i++;
+                    collector = argv[i];
+                    break;
+
+                case 'a':
+                    i++;
+                    rules = argv[i];
+                    break;
             }
         }
         else {
@@ -630,11 +316,30 @@ int main(int argc, const char * argv[])
         }
     }
 
+    Uploader uploader(collector);
+
+    /* Loaded once, whatever the reminders */
+    AlertEngine alerts;
+    if(alerts.load(rules) < 0) {
+        alerts.add_defaults(low_threshold, health_alert, reminder_period);
+    }
+    alerts.load_state(ALERT_STATE);
+
+    /* Carry on from the processes as the last run left them */
+    if(energy) {
+        energy->load(PROC_ENERGY_STATE);
+    }
+
+    /* Alerts aren't waited for */
+    signal(SIGCHLD, SIG_IGN);
 
     while(1) {
         const int remaining = check_batteries(argc - i, &argv[i], sig_sock,
-                low_threshold);
-        printf("Remaining %i\n", remaining);
+                alerts, health_threshold, energy,
+                collector ? &uploader : NULL);
+        alerts.save_state(ALERT_STATE);
+        out_printf("Remaining %i\n", remaining);
+        out_flush();
         if( (reminder_period > time_to_respawn)
             || (remaining > time_to_respawn + reminder_period)) {
             break;
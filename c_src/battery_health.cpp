@@ -0,0 +1,220 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "battery_health.h"
+#include "battery_info.h"
+#include "raw_io.h"
+
+#define HEALTH_PREFIX ROOT_PREFIX "/var/cache/batt_checker/health_"
+
+/* Version of the state file layout */
+#define HEALTH_VERSION 2
+
+/* Add at most one point per hour to the regression */
+#define POINT_INTERVAL (60 * 60)
+
+/* Need this many days of points before trusting the fit */
+#define MIN_FIT_DAYS 7.0
+
+#define SECS_PER_DAY (24.0 * 60 * 60)
+
+/**
+ * The BatteryHealth constructor
+ *
+ * @param[in] name The battery name (as in /sys/class/power_supply)
+ */
+BatteryHealth::BatteryHealth(const char * name)
+{
+    memset(this, 0, sizeof(*this));
+    m_name = name;
+}
+
+/**
+ * Get the name of the state file for this battery
+ */
+void BatteryHealth::state_path(char * path, size_t maxlen) const
+{
+    snprintf(path, maxlen, "%s%s", HEALTH_PREFIX, m_name);
+}
+
+/**
+ * Load the state saved by the last run, if there is one
+ */
+void BatteryHealth::load()
+{
+    char path[256];
+    state_path(path, sizeof(path));
+
+    char buf[1024];
+    if(read_file(path, buf, sizeof(buf)) > 0) {
+        /* Parsed by hand rather than with fscanf(), no stdio */
+        int64_t values[9];
+        double sums[5];
+        char * pos = buf;
+        char * end = pos;
+        int got = 0;
+        for(int i = 0; (i < 9) && (got == i); i++) {
+            values[i] = strtoll(pos, &end, 10);
+            got += (end != pos);
+            pos = end;
+        }
+        for(int i = 0; (i < 5) && (got == 9 + i); i++) {
+            sums[i] = strtod(pos, &end);
+            got += (end != pos);
+            pos = end;
+        }
+        if((got == 14) && (values[0] == HEALTH_VERSION)) {
+            m_first_time = values[1];
+            m_last_time = values[2];
+            m_last_point = values[3];
+            m_last_capacity = MicroJoules(values[4]);
+            m_last_full = MicroJoules(values[5]);
+            m_max_capacity = MicroJoules(values[6]);
+            m_throughput = MicroJoules(values[7]);
+            m_micro_cycles = values[8];
+            m_n = sums[0];
+            m_sx = sums[1];
+            m_sy = sums[2];
+            m_sxx = sums[3];
+            m_sxy = sums[4];
+            m_loaded = true;
+        }
+        else {
+            err_printf("Ignoring bad health state '%s'\n", path);
+        }
+    }
+}
+
+/**
+ * Save the state for the next run. write_file() goes via a temporary file
+ * so a flat battery part way through can't corrupt the history.
+ */
+void BatteryHealth::save() const
+{
+    char path[256];
+    state_path(path, sizeof(path));
+
+    char buf[1024];
+    const int length = snprintf(buf, sizeof(buf), "%i %li %li %li %" PRId64
+            " %" PRId64 " %" PRId64 " %" PRId64 " %" PRId64
+            " %.0f %.17g %.17g %.17g %.17g\n",
+            HEALTH_VERSION, static_cast<long>(m_first_time),
+            static_cast<long>(m_last_time), static_cast<long>(m_last_point),
+            m_last_capacity.micro(), m_last_full.micro(),
+            m_max_capacity.micro(), m_throughput.micro(), m_micro_cycles,
+            m_n, m_sx, m_sy, m_sxx, m_sxy);
+    if((length > 0) && (length < static_cast<int>(sizeof(buf)))) {
+        write_file(path, buf, length);
+    }
+}
+
+/**
+ * Fold the latest battery sample into the health state
+ *
+ * @param[in] info The battery status
+ * @param[in] now The real time of the sample
+ */
+void BatteryHealth::update(const BatteryInfo & info, time_t now)
+{
+    const MicroJoules current = info.get_current_capacity();
+    const MicroJoules last_full = info.get_last_full_capacity();
+    const MicroJoules max_capacity = info.get_max_capacity();
+
+    if(!m_loaded) {
+        m_first_time = now;
+        m_last_point = now - POINT_INTERVAL;
+        m_loaded = true;
+    }
+    else if((current < m_last_capacity) && (last_full > MicroJoules(0))) {
+        /* Charge lost since the last sample counts towards a cycle */
+        const MicroJoules used = m_last_capacity - current;
+        m_throughput += used;
+        m_micro_cycles += used.micro() * 1000000 / last_full.micro();
+    }
+    m_last_time = now;
+    m_last_capacity = current;
+    m_last_full = last_full;
+    m_max_capacity = max_capacity;
+
+    /* Hourly, so floating point is OK here */
+    if((max_capacity > MicroJoules(0)) && (last_full > MicroJoules(0))
+            && (now - m_last_point >= POINT_INTERVAL)) {
+        const double x = (now - m_first_time) / SECS_PER_DAY;
+        const double y = static_cast<double>(last_full.micro())
+            / max_capacity.micro();
+        m_n += 1;
+        m_sx += x;
+        m_sy += y;
+        m_sxx += x * x;
+        m_sxy += x * y;
+        m_last_point = now;
+    }
+}
+
+/**
+ * Calculate the health as last full over design capacity
+ *
+ * @return fraction of the design capacity, 0 if not known
+ */
+float BatteryHealth::calc_health() const
+{
+    if(m_max_capacity > MicroJoules(0)) {
+        return static_cast<float>(m_last_full.micro()) / m_max_capacity.micro();
+    }
+    return 0;
+}
+
+/**
+ * Predict the days until the health drops below the threshold, from the
+ * least squares line through the health history.
+ *
+ * @param[in] threshold The health fraction at which to replace the battery
+ *
+ * @return days left, 0 if already below, -1 if not enough history or the
+ *      health is not fading
+ */
+int BatteryHealth::calc_days_left(float threshold) const
+{
+    const float health = calc_health();
+    if((health > 0) && (health < threshold)) {
+        return 0;
+    }
+    const double denom = m_n * m_sxx - m_sx * m_sx;
+    if((m_n < 2) || (denom <= 0)
+            || (m_last_time - m_first_time < MIN_FIT_DAYS * SECS_PER_DAY)) {
+        return -1;
+    }
+    const double slope = (m_n * m_sxy - m_sx * m_sy) / denom;
+    if(slope >= 0) {
+        return -1;
+    }
+    const double intercept = (m_sy - slope * m_sx) / m_n;
+    const double at = (threshold - intercept) / slope;
+    const double today = (m_last_time - m_first_time) / SECS_PER_DAY;
+    if(at <= today) {
+        return 0;
+    }
+    return static_cast<int>(at - today + 0.5);
+}
+
+/**
+ * print info
+ *
+ * @param[in] threshold The health fraction at which to replace the battery
+ */
+void BatteryHealth::print_self(float threshold) const
+{
+    out_printf("Health=%.1f%% cycles=%.1f\n", calc_health() * 100, get_cycles());
+    const int days = calc_days_left(threshold);
+    if(days >= 0) {
+        out_printf("%i days before health below %.0f%%\n", days, threshold * 100);
+    }
+}
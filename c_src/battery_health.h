@@ -0,0 +1,56 @@
+#ifndef _BATTERY_HEALTH_H_
+#define _BATTERY_HEALTH_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+#include "units.h"
+
+class BatteryInfo;
+
+/**
+ * Long term health of a battery pack, kept in a small state file and
+ * updated a sample at a time.
+ */
+class BatteryHealth
+{
+private:
+    const char * m_name;
+    bool m_loaded;
+    time_t m_first_time;        /* Origin of the regression */
+    time_t m_last_time;         /* Last sample */
+    time_t m_last_point;        /* Last point added to the regression */
+    MicroJoules m_last_capacity;    /* Charge at the last sample */
+    MicroJoules m_last_full;
+    MicroJoules m_max_capacity;
+    MicroJoules m_throughput;       /* Total energy discharged */
+    int64_t m_micro_cycles;         /* Equivalent full cycles * 1000000 */
+
+    /* Running sums for the least squares fit of health against days */
+    double m_n;
+    double m_sx;
+    double m_sy;
+    double m_sxx;
+    double m_sxy;
+
+    void state_path(char * path, size_t maxlen) const;
+public:
+    BatteryHealth(const char * name);
+    void load();
+    void save() const;
+    void update(const BatteryInfo & info, time_t now);
+    float calc_health() const;
+    int calc_days_left(float threshold) const;
+    float get_cycles() const {return m_micro_cycles / 1000000.0f;};
+    int64_t get_micro_cycles() const {return m_micro_cycles;};
+    void print_self(float threshold) const;
+};
+
+#endif
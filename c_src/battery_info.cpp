@@ -0,0 +1,439 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "units.h"
+#include "battery_info.h"
+#include "charge_curve.h"
+#include "history.h"
+#include "raw_io.h"
+
+#define WORST_RATE ROOT_PREFIX "/var/cache/batt_checker/worst_discharge_rate"
+#define MEAN_RATE  ROOT_PREFIX "/var/cache/batt_checker/mean_discharge_rate"
+
+/* Size at which data.log is sealed into a compressed history segment */
+#define SEAL_SIZE (64 * 1024)
+
+/**
+ * read proc file system
+ *
+ * @param[in] base The battery info directory in the proc filesystem
+ * @param[in] file The file in the base directory
+ * @param[out] result The buffer to put contents of the file after reading it
+ * @param[out] maxlen The maximum size of buffer
+ *
+ * @return The actual number of bytes place in result buffer
+ */
+static size_t read_sys(const char * base, const char * file, char * result, size_t maxlen) {
+    size_t length = 0;
+    char pathname[1024];
+    snprintf(pathname, sizeof(pathname), "%s/%s/%s", SYS_PREFIX, base, file);
+//    printf("pathname='%s'\n", pathname);
+    const int f = open(pathname, O_RDONLY);
+    if(f >= 0) {
+        const ssize_t got = read(f, result, maxlen-1);
+        length = got > 0 ? got : 0;
+        while((length > 0) && (result[length-1] == '\n')) {
+            length--;
+        }
+//        printf("reading..%u %u\n", length, maxlen);
+//        perror("");
+        close(f);
+    }
+    result[length] ='\0';
+    return length;
+}
+
+/**
+ * Convert value (a string) to a integer
+ *
+ * @param[in] value as a string
+ *
+ * @return as an integer
+ */
+static int to_int(const char * value)
+{
+    return strtol(value, NULL, 10);
+}
+
+/**
+ * Convert value (a string) to a 64 bit integer, sysfs values in micro-units
+ * can overflow an int
+ *
+ * @param[in] value as a string
+ *
+ * @return as an integer
+ */
+static int64_t to_int64(const char * value)
+{
+    return strtoll(value, NULL, 10);
+}
+
+/**
+ * Read the file of a rate (in W), as written by the analysis
+ *
+ * @param[in] path The file
+ * @param[in,out] rate Replaced by the value in the file if there is one
+ */
+static void read_rate_file(const char * path, MicroWatts * rate)
+{
+    char buf[512];
+    if(read_file(path, buf, sizeof(buf)) > 0) {
+        *rate = MicroWatts(parse_micro(buf, NULL));
+    }
+}
+
+/**
+ * The BatteryInfo constructor
+ */
+BatteryInfo::BatteryInfo(const char * name)
+{
+    memset(this, 0, sizeof(*this));
+    m_name = name;
+}
+
+/**
+ * Read and refresh the is battery present flag
+ */
+void BatteryInfo::read_type()
+{
+    char result[256];
+    int status = read_sys(m_name, "type", result, sizeof(result));
+    if(status > 0) {
+        if(strcasecmp(result, "mains") == 0) {
+            m_present = false;
+        }
+        else if(strcasecmp(result, "battery") == 0) {
+            status = read_sys(m_name, "present", result, sizeof(result));
+            if(status > 0) {
+                m_present = to_int(result) ? true : false;
+            }
+            else {
+                m_present = false;
+            }
+        }
+        else {
+            err_printf("Invalid type '%s'\n", result);
+            m_present = false;
+        }
+    }
+    else {
+        m_present = false;
+    }
+}
+
+/**
+ * Convert text charging state value into two bool values
+ */
+void BatteryInfo::read_charging_state()
+{
+    char result[256];
+
+    const int status = read_sys(m_name, "status", result, sizeof(result));
+    if(status > 0) {
+        if(strcmp(result, "Charging") == 0) {
+            m_charging = true;
+            m_discharging = false;
+        }
+        else if(strcmp(result, "Discharging") == 0) {
+            m_discharging = true;
+            m_charging = false;
+        }
+        else {
+            /* Unknown, Full, Not charging... Also used by the library so
+             * don't exit on a state we don't know */
+            if( (strcmp(result, "Unknown") != 0)
+                    && (strcmp(result, "Full") != 0)) {
+                err_printf("State = '%s'\n", result);
+            }
+            m_charging= false;
+            m_discharging = false;
+        }
+    }
+}
+
+
+
+void BatteryInfo::read_voltage()
+{
+    char result[256];
+    int status = read_sys(m_name, "voltage_now", result, sizeof(result));
+    if(status > 0) {
+        m_volts = MicroVolts(to_int64(result));
+
+        status = read_sys(m_name, "voltage_min_design", result,
+                sizeof(result));
+        if(status > 0) {
+            MicroVolts min_voltage(to_int64(result));
+            if(min_voltage > MicroVolts(100000000)) {
+                /* Some times volts are in pico-volts, err.. */
+                min_voltage = min_voltage / 1000;
+            }
+            if(m_volts * 2 < min_voltage) {
+                out_printf("voltage reading is probably broken\n");
+                m_volts = min_voltage;
+            }
+        }
+    }
+}
+
+void BatteryInfo::read_capacity()
+{
+    char result[256];
+    int status = read_sys(m_name, "energy_full", result, sizeof(result));
+    if(status > 0) {
+        m_last_full_capacity = uwatthr2ujoules(to_int64(result));
+    }
+    else {
+        status = read_sys(m_name, "charge_full", result, sizeof(result));
+        if(status > 0) {
+            m_last_full_capacity = uamphr2ujoules(to_int64(result),
+                    m_volts);
+        }
+    }
+
+    status = read_sys(m_name, "energy_full_design", result, sizeof(result));
+    if(status > 0) {
+        m_max_capacity = uwatthr2ujoules(to_int64(result));
+    }
+    else {
+        status = read_sys(m_name, "charge_full_design", result,
+                sizeof(result));
+        if(status > 0) {
+            m_max_capacity = uamphr2ujoules(to_int64(result), m_volts);
+        }
+    }
+
+    status = read_sys(m_name, "energy_now", result, sizeof(result));
+    if(status > 0) {
+        m_current_capacity = uwatthr2ujoules(to_int64(result));
+    }
+    else {
+        status = read_sys(m_name, "charge_now", result, sizeof(result));
+        if(status > 0) {
+           m_current_capacity = uamphr2ujoules(to_int64(result),
+                    m_volts);
+        }
+    }
+
+    read_sys(m_name, "alarm", result, sizeof(result));
+    if(status > 0) {
+        m_min_capacity = uwatthr2ujoules(to_int64(result));
+    }
+    else {
+        m_min_capacity = uamphr2ujoules(to_int64(result),
+                m_volts);
+    }
+}
+
+void BatteryInfo::read_rate()
+{
+    char result[256];
+    int status = read_sys(m_name, "power_now", result, sizeof(result));
+    if(status > 0) {
+        m_rate = MicroWatts(to_int64(result));
+    }
+    else {
+        read_sys(m_name, "current_now", result, sizeof(result));
+        m_rate = MicroAmps(to_int64(result)) * m_volts;
+    }
+}
+
+/**
+ * Fill in the BatterInfo_t structure with information read from the proc
+ * filesystem about battery name
+ *
+ * @param[out] info The Battery status
+ */
+void BatteryInfo::check_battery()
+{
+    read_type();
+    if(!is_present()) {
+        return;
+    }
+
+    read_charging_state();
+    read_voltage();
+    read_capacity();
+    read_rate();
+}
+
+/**
+ * Estimate in mins until battery reaches minimum charge
+ *
+ * @param[in] info The battery status
+ * @param[in] min The minimum charge
+ *
+ * @return estimated time in minutes
+ */
+int BatteryInfo::calc_left(MicroJoules min) const
+{
+    if(is_discharging()) {
+        const MicroJoules left = m_current_capacity - min;
+        MicroWatts mean_rate = m_rate;
+
+        if(mean_rate < MicroWatts(100)) {
+            read_rate_file(MEAN_RATE, &mean_rate);
+        }
+        if(mean_rate > MicroWatts(0)) {
+            return secs_to_use(left, mean_rate * 60);
+        }
+    }
+    return 999;
+}
+
+/**
+ * Calculate part/total as a percentage
+ *
+ * @param[in] part (the numerator)
+ * @param[in] total (the denomator)
+ *
+ * @return percentage or -1 if out of range
+ */
+static int calc_percent(MicroJoules part, MicroJoules total)
+{
+    if(total > part) {
+        return (part.micro() * 100 + total.micro() / 2) / total.micro();
+    }
+    return -1;
+}
+
+
+
+int BatteryInfo::calc_fullness(MicroJoules min) const
+{
+    return calc_percent(m_current_capacity - min,
+                        m_last_full_capacity - min);
+}
+
+/**
+ * Open the database that contains history of previous measurements
+ * and calculate the worst case (minimum time) for when battery will
+ * go below the min threshold.
+ *
+ * @param[in] info The battery status
+ * @param[in] min The minimum charge
+ *
+ * @return estimated time in minutes
+ */
+int BatteryInfo::calc_next_period(MicroJoules min) const
+{
+    MicroWatts worst_rate(15000000);
+    const MicroJoules left = m_current_capacity - min;
+
+    read_rate_file(WORST_RATE, &worst_rate);
+    if(worst_rate < m_rate) {
+        worst_rate = m_rate;
+    }
+    if(worst_rate <= MicroWatts(0)) {
+        return 9999;
+    }
+    return secs_to_use(left, worst_rate * 60);
+}
+
+/**
+ * print info
+ *
+ * @param[in] curve The learnt charge curve, for the time to full
+ */
+void BatteryInfo::print_self(const ChargeCurve & curve) const
+{
+    if(!is_present()) {
+        out_printf("No battery\n");
+        return;
+    }
+
+    out_printf("Max      =%10.1f J (%3i%%)\n", m_max_capacity.to_float(), 100);
+    out_printf("Last full=%10.1f J (%3i%%)\n", m_last_full_capacity.to_float(),
+            calc_percent(m_last_full_capacity, m_max_capacity));
+    out_printf("Current  =%10.1f J (%3i%%)\n", m_current_capacity.to_float(),
+            calc_percent(m_current_capacity, m_max_capacity));
+    out_printf("Min      =%10.1f J (%3i%%)\n", m_min_capacity.to_float(),
+            calc_percent(m_min_capacity, m_max_capacity));
+
+    out_printf("volts=%.2f v\n", m_volts.to_float());
+
+//    info->m_min_capacity = 0
+    if(is_charging()) {
+        const int minutes = curve.calc_time_to_full(m_current_capacity,
+                m_last_full_capacity, m_rate);
+        out_printf("Charging rate=%f J/s\n", m_rate.to_float());
+        out_printf( "%i mins left to reach last full\n", minutes);
+    }
+    if(is_discharging()) {
+        out_printf("Discharging rate=%f J/s\n", m_rate.to_float());
+        out_printf("%i mins left before flat\n", calc_left(MicroJoules()));
+    }
+}
+
+/**
+ * Get the battery model, as the manufacturer and model name. Only read when
+ * asked for, the checker doesn't need it every sample.
+ *
+ * @param[out] model The model, empty if unknown
+ * @param[in] maxlen The size of model
+ */
+void BatteryInfo::get_model(char * model, size_t maxlen) const
+{
+    char manufacturer[64];
+    char model_name[64];
+    read_sys(m_name, "manufacturer", manufacturer, sizeof(manufacturer));
+    read_sys(m_name, "model_name", model_name, sizeof(model_name));
+    snprintf(model, maxlen, "%s%s%s", manufacturer,
+            (manufacturer[0] && model_name[0]) ? " " : "", model_name);
+}
+
+/**
+ * Get the sample of the current state, for the history
+ *
+ * @param[out] sample The sample, timestamped now
+ */
+void BatteryInfo::get_sample(HistorySample * sample) const
+{
+    struct timespec up_time;
+    clock_gettime(CLOCK_MONOTONIC, &up_time);
+
+    sample->real_time = time(NULL);
+    sample->up_time = up_time.tv_sec;
+    sample->status = is_charging() ? HISTORY_CHARGING
+        : is_discharging() ? HISTORY_DISCHARGING : HISTORY_IDLE;
+    sample->capacity = m_current_capacity;
+    sample->volts = m_volts;
+}
+
+/**
+ * Write to the history database
+ *
+ * @param[in] sample The sample to add
+ */
+void BatteryInfo::open_database(const HistorySample & sample) const
+{
+    char line[256];
+    history_format_line(sample, line, sizeof(line));
+
+    const int fd = open(CACHE_LOG, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(fd >= 0) {
+        /* Locked so we don't append while it is being sealed */
+        flock(fd, LOCK_EX);
+        const ssize_t length = strlen(line);
+        const bool written = write(fd, line, length) == length;
+        struct stat st;
+        const bool seal = written && (fstat(fd, &st) == 0) && (st.st_size >= SEAL_SIZE);
+        close(fd);
+        if(seal && !history_seal(CACHE_LOG, HISTORY_DIR)) {
+            out_printf("Failed to seal %s\n", CACHE_LOG);
+        }
+    }
+}
@@ -8,6 +8,17 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
+
+#include "root_prefix.h"
+#include "units.h"
+
+#define SYS_PREFIX ROOT_PREFIX "/sys/class/power_supply"
+#define CACHE_LOG  ROOT_PREFIX "/var/cache/batt_checker/data.log"
+#define HISTORY_DIR ROOT_PREFIX "/var/cache/batt_checker/history"
+
+class ChargeCurve;
+struct HistorySample;
 
 class BatteryInfo
 {
@@ -15,12 +26,12 @@ private:
     int m_present;
     bool m_charging;
     bool m_discharging;
-    float m_max_capacity;
-    float m_last_full_capacity;
-    float m_current_capacity;
-    float m_min_capacity;
-    float m_volts;
-    float m_rate;
+    MicroJoules m_max_capacity;
+    MicroJoules m_last_full_capacity;
+    MicroJoules m_current_capacity;
+    MicroJoules m_min_capacity;
+    MicroVolts m_volts;
+    MicroWatts m_rate;
     const char * m_name;
 
     void read_type();
@@ -33,12 +44,19 @@ public:
     bool is_present() const {return m_present;};
     bool is_discharging() const {return m_discharging;};
     bool is_charging() const {return m_charging;};
+    MicroWatts get_rate() const {return m_rate;};
+    MicroJoules get_max_capacity() const {return m_max_capacity;};
+    MicroJoules get_last_full_capacity() const {return m_last_full_capacity;};
+    MicroJoules get_current_capacity() const {return m_current_capacity;};
+    MicroVolts get_volts() const {return m_volts;};
     void check_battery();
-    int calc_left(float min) const;
-    int calc_fullness(float min) const;
-    int calc_next_period(float min) const;
-    void print_self() const;
-    void open_database() const;
+    int calc_left(MicroJoules min) const;
+    int calc_fullness(MicroJoules min) const;
+    int calc_next_period(MicroJoules min) const;
+    void print_self(const ChargeCurve & curve) const;
+    void get_model(char * model, size_t maxlen) const;
+    void get_sample(HistorySample * sample) const;
+    void open_database(const HistorySample & sample) const;
 };
 
 #endif
@@ -4,8 +4,8 @@
 # Licensed under the GPL License. See LICENSE file in the project root for full license information.  
 ##
 
-CFLAGS=-Wall -O3 -Wextra
-CXXFLAGS=$(CFLAGS)
+CFLAGS=-Wall -O3 -Wextra -fPIC
+CXXFLAGS=$(CFLAGS) -fno-exceptions -fvisibility=hidden
 
 CPPFLAGS= -I$(SRCDIR)/../common -DDEBUG
 
@@ -16,15 +16,53 @@ MAKEDEPEND=gcc -M $(CPPFLAGS)
 LD=gcc
 #-lstdc++
 
-OBJS= battery.o
+# The tiny build of the checker, to measure what the oneshot run every 15
+# minutes costs when startup is cut to the bone: static (no dynamic
+# loading), no exceptions, RTTI or unwind tables, unused code dropped.
+# Override TINY_LD with a smaller libc's wrapper (e.g. musl-gcc) for a
+# smaller footprint still. It is only for the startup benchmark, so it isn't
+# installed, and its paths are under TINY_ROOT (relative to where it is run
+# from) so it never reads or writes the host's /sys and /var.
+TINY_CXXFLAGS=-Wall -Wextra -Os -fno-exceptions -fno-rtti -fvisibility=hidden \
+    -fno-asynchronous-unwind-tables -fno-unwind-tables -fno-stack-protector \
+    -ffunction-sections -fdata-sections
+TINY_LD=$(LD)
+TINY_LDFLAGS=-static -Wl,--gc-sections -Wl,-z,norelro -s
+TINY_ROOT=.
 
-.PHONY: all
-all: batt_checker
+LIB_OBJS= battery_info.o battery_health.o charge_curve.o history.o raw_io.o units.o
+OBJS= alerts.o battery.o fleet.o proc_energy.o uploader.o $(LIB_OBJS)
+HISTORY_OBJS= batt_history.o history.o units.o
+COLLECTOR_OBJS= batt_collector.o fleet.o fleet_store.o history.o raw_io.o units.o
+SONAME=libbattchecker.so.1
+
+TINY_OBJS= $(OBJS:.o=.tiny.o)
+
+.PHONY: all tiny
+all: batt_checker batt_history batt_collector libbattchecker.so tiny
+
+tiny: batt_checker.tiny
 
 
 batt_checker : $(OBJS)
 	$(LD) $(LDFLAGS) $(OBJS) -o $@
 
+batt_checker.tiny : $(TINY_OBJS)
+	$(TINY_LD) $(TINY_LDFLAGS) $(TINY_OBJS) -o $@
+
+$(SONAME) : battchecker.o $(LIB_OBJS)
+	$(LD) $(LDFLAGS) -shared -Wl,-soname,$(SONAME) battchecker.o $(LIB_OBJS) -o $@
+
+# The name to link with, to the real library
+libbattchecker.so : $(SONAME)
+	ln -sf $(SONAME) $@
+
+batt_history : $(HISTORY_OBJS)
+	$(LD) $(LDFLAGS) $(HISTORY_OBJS) -o $@
+
+batt_collector : $(COLLECTOR_OBJS)
+	$(LD) $(LDFLAGS) $(COLLECTOR_OBJS) -o $@
+
 %.o : %.c
 	$(CC) -c $(CFLAGS) $(CPPFLAGS) -MMD -o $@ $<
 	@cp $*.d $*.P
@@ -39,4 +77,12 @@ batt_checker : $(OBJS)
 	@$(RM) $*.d
 	@mv $*.P $*.d
 
--include $(OBJS:.o=.d)
+%.tiny.o : %.cpp
+	$(CXX) -c $(TINY_CXXFLAGS) $(CPPFLAGS) -DROOT_PREFIX='"$(TINY_ROOT)"' -MMD -o $@ $<
+	@cp $*.tiny.d $*.tiny.P
+	@sed -e 's/#.*//' -e 's/^[^:]*: *//' -e 's/ *\\$$//' -e '/^$$/ d' -e 's/$$/ :/' < $*.tiny.d >> $*.tiny.P
+	@$(RM) $*.tiny.d
+	@mv $*.tiny.P $*.tiny.d
+
+-include $(OBJS:.o=.d) $(TINY_OBJS:.o=.d) $(HISTORY_OBJS:.o=.d) \
+	$(COLLECTOR_OBJS:.o=.d) battchecker.d
@@ -0,0 +1,227 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "charge_curve.h"
+#include "battery_info.h"
+#include "raw_io.h"
+
+#define CURVE_PREFIX ROOT_PREFIX "/var/cache/batt_checker/charge_curve_"
+
+/* Version of the state file layout */
+#define CURVE_VERSION 2
+
+/*
+ * A bucket is a plain mean until it has this many samples, then the
+ * weight of the history is halved so it follows the pack as it ages.
+ * Halving, rather than a moving average, stops the slow samples at the end
+ * of each bucket from dominating.
+ */
+#define MAX_WEIGHT 64
+
+/* Samples a bucket needs before it is trusted */
+#define MIN_COUNT 2
+
+/**
+ * The ChargeCurve constructor
+ *
+ * @param[in] name The battery name (as in /sys/class/power_supply)
+ */
+ChargeCurve::ChargeCurve(const char * name)
+{
+    memset(this, 0, sizeof(*this));
+    m_name = name;
+}
+
+/**
+ * Get the name of the state file for this battery
+ */
+void ChargeCurve::state_path(char * path, size_t maxlen) const
+{
+    snprintf(path, maxlen, "%s%s", CURVE_PREFIX, m_name);
+}
+
+/**
+ * Load the curve learnt so far, if there is one and it makes sense
+ */
+void ChargeCurve::load()
+{
+    char path[256];
+    state_path(path, sizeof(path));
+
+    char buf[1024];
+    if(read_file(path, buf, sizeof(buf)) > 0) {
+        char * end;
+        bool ok = (strtol(buf, &end, 10) == CURVE_VERSION) && (end != buf);
+        for(int i = 0; ok && (i < CHARGE_BUCKETS); i++) {
+            char * pos = end;
+            m_rate[i] = MicroWatts(strtoll(pos, &end, 10));
+            ok = (end != pos);
+            pos = end;
+            m_count[i] = strtoul(pos, &end, 10);
+            /* Learnt rates are divided by, so must be positive */
+            ok = ok && (end != pos) && (m_count[i] <= MAX_WEIGHT)
+                && ((m_count[i] == 0) || (m_rate[i] > MicroWatts()));
+        }
+        if(!ok) {
+            err_printf("Ignoring bad charge curve '%s'\n", path);
+            for(int i = 0; i < CHARGE_BUCKETS; i++) {
+                m_rate[i] = MicroWatts();
+                m_count[i] = 0;
+            }
+        }
+    }
+}
+
+/**
+ * Save the curve for the next run, via a temporary file
+ */
+void ChargeCurve::save() const
+{
+    char path[256];
+    state_path(path, sizeof(path));
+
+    char buf[1024];
+    int length = snprintf(buf, sizeof(buf), "%i\n", CURVE_VERSION);
+    for(int i = 0; i < CHARGE_BUCKETS; i++) {
+        length += snprintf(buf + length, sizeof(buf) - length, "%" PRId64 " %u\n",
+                m_rate[i].micro(), m_count[i]);
+    }
+    if(length < static_cast<int>(sizeof(buf))) {
+        write_file(path, buf, length);
+    }
+}
+
+/**
+ * Map charge to a bucket
+ *
+ * @param[in] current The current charge
+ * @param[in] full The charge when full
+ *
+ * @return The bucket index
+ */
+static int to_bucket(MicroJoules current, MicroJoules full)
+{
+    int bucket = current.micro() * CHARGE_BUCKETS / full.micro();
+    if(bucket < 0) {
+        bucket = 0;
+    }
+    if(bucket >= CHARGE_BUCKETS) {
+        bucket = CHARGE_BUCKETS - 1;
+    }
+    return bucket;
+}
+
+/**
+ * Learn from the latest battery sample, if it is charging
+ *
+ * @param[in] info The battery status
+ *
+ * @return true if the curve changed
+ */
+bool ChargeCurve::update(const BatteryInfo & info)
+{
+    if(!info.is_charging()) {
+        return false;
+    }
+    learn(info.get_current_capacity(), info.get_last_full_capacity(),
+            info.get_rate());
+    return true;
+}
+
+/**
+ * Add a charge rate sample to the curve
+ *
+ * @param[in] current The current charge
+ * @param[in] full The charge when last full
+ * @param[in] rate The charge rate
+ */
+void ChargeCurve::learn(MicroJoules current, MicroJoules full, MicroWatts rate)
+{
+    if((full <= MicroJoules(0)) || (rate <= MicroWatts(0)) || (current >= full)) {
+        return;
+    }
+    const int bucket = to_bucket(current, full);
+    if(m_count[bucket] >= MAX_WEIGHT) {
+        m_count[bucket] /= 2;
+    }
+    m_count[bucket]++;
+    m_rate[bucket] += (rate - m_rate[bucket]) / m_count[bucket];
+}
+
+/**
+ * Time to charge between two points, with the rate changing linearly from
+ * one to the other. Uses Simpson's rule, which is within a few % of the
+ * exact (logarithmic) answer for rates that differ by 4x.
+ *
+ * @param[in] energy The charge to add
+ * @param[in] from_rate The rate at the start
+ * @param[in] to_rate The rate at the end
+ *
+ * @return time in milli-seconds
+ */
+static int64_t charge_time(MicroJoules energy, MicroWatts from_rate,
+        MicroWatts to_rate)
+{
+    const int64_t scaled = energy.micro() * 1000;
+    const MicroWatts mid_rate = (from_rate + to_rate) / 2;
+    return (scaled / from_rate.micro() + 4 * scaled / mid_rate.micro()
+            + scaled / to_rate.micro()) / 6;
+}
+
+/**
+ * Estimate the time to reach full by integrating over the learnt curve
+ * above the current charge. The rate is taken to be linear between bucket
+ * centres and flat beyond the last one. Buckets not learnt yet use the
+ * measured rate.
+ *
+ * @param[in] current The current charge
+ * @param[in] full The charge when last full
+ * @param[in] rate The measured charge rate
+ *
+ * @return estimated time in minutes, -1 if not charging
+ */
+int ChargeCurve::calc_time_to_full(MicroJoules current, MicroJoules full,
+        MicroWatts rate) const
+{
+    if((full <= MicroJoules(0)) || (rate <= MicroWatts(0))) {
+        return -1;
+    }
+    if(current >= full) {
+        return 0;
+    }
+    const MicroJoules bucket_size = full / CHARGE_BUCKETS;
+
+    /* Start from the centre at or below current */
+    int i = (2 * current.micro() / bucket_size.micro() - 1) / 2;
+    if(i < 0) {
+        i = 0;
+    }
+    MicroJoules from = current;
+    MicroWatts from_rate = m_count[i] >= MIN_COUNT ? m_rate[i] : rate;
+    int64_t msecs = 0;
+    for(; i < CHARGE_BUCKETS - 1; i++) {
+        const MicroJoules to = bucket_size * (2 * i + 3) / 2;
+        const MicroWatts to_rate = m_count[i+1] >= MIN_COUNT ? m_rate[i+1] : rate;
+        if(to > from) {
+            const MicroJoules centre = bucket_size * (2 * i + 1) / 2;
+            if(from > centre) {
+                /* Rate at current, part way between the centres */
+                from_rate += MicroWatts(muldiv((to_rate - from_rate).micro(),
+                            (from - centre).micro(), bucket_size.micro()));
+            }
+            msecs += charge_time(to - from, from_rate, to_rate);
+            from = to;
+        }
+        from_rate = to_rate;
+    }
+    msecs += (full - from).micro() * 1000 / from_rate.micro();
+    return (msecs + 30000) / 60000;
+}
@@ -0,0 +1,43 @@
+#ifndef _CHARGE_CURVE_H_
+#define _CHARGE_CURVE_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "units.h"
+
+/* Number of state of charge buckets, each covers 100/CHARGE_BUCKETS % */
+#define CHARGE_BUCKETS 20
+
+class BatteryInfo;
+
+/**
+ * Charging rate as a function of state of charge, learnt from the battery's
+ * own history. Used to estimate the time to full, including the slow taper
+ * at the top end.
+ */
+class ChargeCurve
+{
+private:
+    const char * m_name;
+    MicroWatts m_rate[CHARGE_BUCKETS];  /* Mean charge rate */
+    unsigned m_count[CHARGE_BUCKETS];   /* Samples behind each mean */
+
+    void state_path(char * path, size_t maxlen) const;
+public:
+    ChargeCurve(const char * name);
+    void load();
+    void save() const;
+    bool update(const BatteryInfo & info);
+    void learn(MicroJoules current, MicroJoules full, MicroWatts rate);
+    int calc_time_to_full(MicroJoules current, MicroJoules full,
+            MicroWatts rate) const;
+};
+
+#endif
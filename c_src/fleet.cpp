@@ -0,0 +1,344 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <arpa/inet.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "fleet.h"
+#include "history.h"
+
+static void put_le32(uint8_t * data, uint32_t value)
+{
+    for(int i = 0; i < 4; i++) {
+        data[i] = value >> (8 * i);
+    }
+}
+
+static uint32_t get_le32(const uint8_t * data)
+{
+    return data[0] | (data[1] << 8) | (data[2] << 16)
+        | (static_cast<uint32_t>(data[3]) << 24);
+}
+
+/**
+ * Send all of a buffer, without a SIGPIPE if the other end has gone
+ */
+static bool send_all(int fd, const uint8_t * data, size_t length)
+{
+    while(length > 0) {
+        const ssize_t done = send(fd, data, length, MSG_NOSIGNAL);
+        if(done <= 0) {
+            return false;
+        }
+        data += done;
+        length -= done;
+    }
+    return true;
+}
+
+/**
+ * Check a host or battery name, which become directory names in the store
+ *
+ * @return true if it is 1 to FLEET_MAX_NAME of [A-Za-z0-9._-], not starting
+ *      with a '.'
+ */
+bool fleet_valid_name(const char * name)
+{
+    size_t length = 0;
+    for(; name[length]; length++) {
+        const char c = name[length];
+        if(!(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))
+                || ((c >= '0') && (c <= '9')) || (c == '.') || (c == '_')
+                || (c == '-'))) {
+            return false;
+        }
+    }
+    return (length > 0) && (length <= FLEET_MAX_NAME) && (name[0] != '.');
+}
+
+/**
+ * Check a battery model, printable and no tabs (the query output is tab
+ * separated)
+ */
+bool fleet_valid_model(const char * model)
+{
+    size_t length = 0;
+    for(; model[length]; length++) {
+        if((model[length] < ' ') || (model[length] > '~')) {
+            return false;
+        }
+    }
+    return length <= FLEET_MAX_NAME;
+}
+
+/**
+ * Add a length prefixed name
+ */
+static uint8_t * put_name(uint8_t * data, const char * name)
+{
+    const size_t length = strlen(name);
+    *data++ = length;
+    memcpy(data, name, length);
+    return data + length;
+}
+
+/**
+ * Get a length prefixed name
+ *
+ * @return After the name, or NULL if it runs past end or is too long
+ */
+static const uint8_t * get_name(const uint8_t * data, const uint8_t * end,
+        char * name)
+{
+    if((data >= end) || (*data > FLEET_MAX_NAME) || (*data >= end - data)) {
+        return NULL;
+    }
+    const size_t length = *data++;
+    memcpy(name, data, length);
+    name[length] = '\0';
+    return data + length;
+}
+
+/**
+ * Build the message for an upload
+ *
+ * @param[in] upload The upload
+ * @param[out] buf The message
+ * @param[in] maxlen The size of buf
+ *
+ * @return The length of the message, 0 if it doesn't fit
+ */
+size_t fleet_encode(const FleetUpload & upload, uint8_t * buf, size_t maxlen)
+{
+    const size_t length = FLEET_HEADER_SIZE + 3 + strlen(upload.host)
+        + strlen(upload.battery) + strlen(upload.model) + upload.segment_length;
+    if((length > maxlen) || (length > FLEET_MAX_MESSAGE)) {
+        return 0;
+    }
+    memcpy(buf, FLEET_MAGIC, 4);
+    put_le32(buf + 4, length - FLEET_HEADER_SIZE);
+    uint8_t * data = put_name(buf + FLEET_HEADER_SIZE, upload.host);
+    data = put_name(data, upload.battery);
+    data = put_name(data, upload.model);
+    memcpy(data, upload.segment, upload.segment_length);
+    return length;
+}
+
+/**
+ * Get the length of a message from its header
+ *
+ * @param[in] header The first FLEET_HEADER_SIZE bytes
+ *
+ * @return The whole length, -1 if not a message or too big
+ */
+long fleet_message_length(const uint8_t * header)
+{
+    if(memcmp(header, FLEET_MAGIC, 4) != 0) {
+        return -1;
+    }
+    const uint32_t length = get_le32(header + 4);
+    if(length > FLEET_MAX_MESSAGE - FLEET_HEADER_SIZE) {
+        return -1;
+    }
+    return FLEET_HEADER_SIZE + length;
+}
+
+/**
+ * Decode and check a whole message
+ *
+ * @param[in] data The message
+ * @param[in] length Its length
+ * @param[out] upload The upload, the segment points in to data
+ *
+ * @return false if it isn't a valid upload
+ */
+bool fleet_decode(const uint8_t * data, size_t length, FleetUpload * upload)
+{
+    if((length < FLEET_HEADER_SIZE)
+            || (fleet_message_length(data) != static_cast<long>(length))) {
+        return false;
+    }
+    const uint8_t * end = data + length;
+    data = get_name(data + FLEET_HEADER_SIZE, end, upload->host);
+    data = data ? get_name(data, end, upload->battery) : NULL;
+    data = data ? get_name(data, end, upload->model) : NULL;
+    if(!data || !fleet_valid_name(upload->host) || !fleet_valid_name(upload->battery)
+            || !fleet_valid_model(upload->model)) {
+        return false;
+    }
+    upload->segment = data;
+    upload->segment_length = end - data;
+
+    uint32_t count;
+    int64_t first_real, last_real;
+    return history_segment_info(upload->segment, upload->segment_length, &count,
+            &first_real, &last_real) && (count > 0);
+}
+
+/**
+ * Parse an address (see fleet.h)
+ *
+ * @param[in] addr The address
+ * @param[out] sa The socket address
+ *
+ * @return Its length, 0 if it can't be parsed
+ */
+static socklen_t parse_addr(const char * addr, sockaddr_storage * sa)
+{
+    memset(sa, 0, sizeof(*sa));
+    if(strchr(addr, '/')) {
+        sockaddr_un * un = reinterpret_cast<sockaddr_un *>(sa);
+        if(strlen(addr) >= sizeof(un->sun_path)) {
+            return 0;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, addr);
+        return sizeof(*un);
+    }
+
+    const char * colon = strrchr(addr, ':');
+    if(!colon) {
+        return 0;
+    }
+    char host[64];
+    const char * start = addr;
+    size_t length = colon - addr;
+    if((addr[0] == '[') && (length >= 2) && (colon[-1] == ']')) {
+        start++;
+        length -= 2;
+    }
+    if(length >= sizeof(host)) {
+        return 0;
+    }
+    memcpy(host, start, length);
+    host[length] = '\0';
+    char * end;
+    const long port = strtol(colon + 1, &end, 10);
+    if((*end != '\0') || (port <= 0) || (port > 65535)) {
+        return 0;
+    }
+
+    sockaddr_in * in = reinterpret_cast<sockaddr_in *>(sa);
+    sockaddr_in6 * in6 = reinterpret_cast<sockaddr_in6 *>(sa);
+    if(length == 0) {
+        in->sin_family = AF_INET;
+        in->sin_addr.s_addr = htonl(INADDR_ANY);
+    }
+    else if(inet_pton(AF_INET, host, &in->sin_addr) == 1) {
+        in->sin_family = AF_INET;
+    }
+    else if(inet_pton(AF_INET6, host, &in6->sin6_addr) == 1) {
+        in6->sin6_family = AF_INET6;
+        in6->sin6_port = htons(port);
+        return sizeof(*in6);
+    }
+    else {
+        return 0;
+    }
+    in->sin_port = htons(port);
+    return sizeof(*in);
+}
+
+/**
+ * Connect to a collector
+ *
+ * @param[in] addr The collector's address
+ * @param[in] timeout_secs How long to wait for the connection, and for
+ *      each send and receive after
+ *
+ * @return The socket, -1 if it can't connect
+ */
+int fleet_connect(const char * addr, int timeout_secs)
+{
+    sockaddr_storage sa;
+    const socklen_t length = parse_addr(addr, &sa);
+    if(length == 0) {
+        return -1;
+    }
+    const int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    struct timeval timeout;
+    timeout.tv_sec = timeout_secs;
+    timeout.tv_usec = 0;
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if(connect(fd, reinterpret_cast<sockaddr *>(&sa), length) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Listen for uploads, an AF_UNIX socket left from before is replaced
+ *
+ * @param[in] addr The address to listen on
+ *
+ * @return The non-blocking listening socket, -1 if it fails
+ */
+int fleet_listen(const char * addr)
+{
+    sockaddr_storage sa;
+    const socklen_t length = parse_addr(addr, &sa);
+    if(length == 0) {
+        return -1;
+    }
+    const int fd = socket(sa.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        return -1;
+    }
+    if(sa.ss_family == AF_UNIX) {
+        unlink(addr);
+    }
+    else {
+        const int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    }
+    if((bind(fd, reinterpret_cast<sockaddr *>(&sa), length) != 0)
+            || (listen(fd, SOMAXCONN) != 0)) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Upload to a collector and wait for it to be stored
+ *
+ * @param[in] addr The collector's address
+ * @param[in] upload The upload
+ * @param[in] timeout_secs How long to wait at each step
+ *
+ * @return true if the collector stored it
+ */
+bool fleet_send(const char * addr, const FleetUpload & upload, int timeout_secs)
+{
+    const size_t maxlen = FLEET_HEADER_SIZE + 3 * (FLEET_MAX_NAME + 1)
+        + upload.segment_length;
+    uint8_t * buf = static_cast<uint8_t *>(malloc(maxlen));
+    const size_t length = buf ? fleet_encode(upload, buf, maxlen) : 0;
+    bool stored = false;
+    if(length > 0) {
+        const int fd = fleet_connect(addr, timeout_secs);
+        if(fd >= 0) {
+            char reply;
+            stored = send_all(fd, buf, length)
+                && (shutdown(fd, SHUT_WR) == 0) && (read(fd, &reply, 1) == 1)
+                && (reply == FLEET_STORED);
+            close(fd);
+        }
+    }
+    free(buf);
+    return stored;
+}
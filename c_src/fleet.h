@@ -0,0 +1,64 @@
+#ifndef _FLEET_H_
+#define _FLEET_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * The upload protocol between batt_checker and batt_collector. A client
+ * connects (TCP or AF_UNIX), sends one message and gets back one byte,
+ * FLEET_STORED or FLEET_REJECTED. A message is:
+ *
+ *     "BCU1"  magic
+ *     u32     length of the rest, little endian
+ *     u8      host length, then the host
+ *     u8      battery length, then the battery (e.g. BAT0)
+ *     u8      model length, then the model
+ *     ...     a history segment (as history.h) holding the samples
+ *
+ * Addresses are "/path/to/socket" (anything with a '/') for AF_UNIX, or
+ * "a.b.c.d:port" or "[v6 address]:port" for TCP. Numeric only, so the
+ * static checker doesn't need the resolver; ":port" to listen on all
+ * interfaces.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FLEET_MAGIC "BCU1"
+#define FLEET_HEADER_SIZE 8
+#define FLEET_MAX_MESSAGE (4 * 1024 * 1024)
+#define FLEET_MAX_NAME 63
+
+/* The reply */
+#define FLEET_STORED 'K'
+#define FLEET_REJECTED 'E'
+
+/**
+ * One upload, the names are '\0' terminated
+ */
+struct FleetUpload
+{
+    char host[FLEET_MAX_NAME + 1];
+    char battery[FLEET_MAX_NAME + 1];
+    char model[FLEET_MAX_NAME + 1];
+    const uint8_t * segment;
+    size_t segment_length;
+};
+
+bool fleet_valid_name(const char * name);
+bool fleet_valid_model(const char * model);
+
+size_t fleet_encode(const FleetUpload & upload, uint8_t * buf, size_t maxlen);
+long fleet_message_length(const uint8_t * header);
+bool fleet_decode(const uint8_t * data, size_t length, FleetUpload * upload);
+
+int fleet_connect(const char * addr, int timeout_secs);
+int fleet_listen(const char * addr);
+bool fleet_send(const char * addr, const FleetUpload & upload, int timeout_secs);
+
+#endif
@@ -0,0 +1,684 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "fleet_store.h"
+#include "history.h"
+#include "raw_io.h"
+
+/**
+ * The rates of all the batteries of one model
+ */
+struct ModelRates
+{
+    char model[FLEET_MAX_NAME + 1];
+    unsigned batteries;
+    size_t count;
+    size_t size;
+    int64_t * rates;            /* uW, one per clean discharge interval */
+};
+
+/**
+ * What a query gathers from the store
+ */
+struct FleetTotals
+{
+    unsigned hosts;
+    unsigned batteries;
+    uint64_t batches;
+    uint64_t samples;
+    ModelRates * models;
+    int num_models;
+    int models_size;
+    HistoryColumns columns;     /* Scratch for decoding a segment */
+    size_t columns_size;
+};
+
+/**
+ * FNV-1a, continuing from hash
+ */
+static uint32_t fnv1a(uint32_t hash, const char * text)
+{
+    for(; *text; text++) {
+        hash = (hash ^ static_cast<uint8_t>(*text)) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t hash_key(const char * host, const char * battery)
+{
+    return fnv1a(fnv1a(2166136261u, host) * 16777619u, battery);
+}
+
+/**
+ * Pick the shard of a host
+ */
+unsigned fleet_shard_of(const char * host)
+{
+    return fnv1a(2166136261u, host) % FLEET_SHARDS;
+}
+
+/**
+ * Read the whole of an open file
+ *
+ * @param[in] fd The file
+ * @param[out] length Set to the number of bytes read
+ *
+ * @return The contents, '\0' terminated (free() it), or NULL
+ */
+static char * read_all(int fd, size_t * length)
+{
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        return NULL;
+    }
+    char * data = static_cast<char *>(malloc(st.st_size + 1));
+    if(data) {
+        const ssize_t got = pread(fd, data, st.st_size, 0);
+        *length = got > 0 ? got : 0;
+        data[*length] = '\0';
+    }
+    return data;
+}
+
+/**
+ * The FleetShard constructor
+ */
+FleetShard::FleetShard()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+FleetShard::~FleetShard()
+{
+    close();
+}
+
+/**
+ * Open a shard, loading its keys
+ *
+ * @param[in] store The store directory
+ * @param[in] shard Which shard
+ * @param[in] writable To append to it, with the index loaded to spot resends
+ *
+ * @return false if it can't be opened (or doesn't exist yet, if not writable)
+ */
+bool FleetShard::open(const char * store, unsigned shard, bool writable)
+{
+    close();
+    const int flags = writable ? (O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC)
+        : (O_RDONLY | O_CLOEXEC);
+    char path[1024];
+    m_open = true;
+    snprintf(path, sizeof(path), "%s/%02x.keys", store, shard);
+    m_keys_fd = ::open(path, flags, 0644);
+    snprintf(path, sizeof(path), "%s/%02x.data", store, shard);
+    m_data_fd = m_keys_fd >= 0 ? ::open(path, flags, 0644) : -1;
+    snprintf(path, sizeof(path), "%s/%02x.index", store, shard);
+    m_index_fd = m_data_fd >= 0 ? ::open(path, flags, 0644) : -1;
+
+    struct stat st;
+    if((m_index_fd < 0) || (fstat(m_data_fd, &st) != 0) || !load_keys()
+            || (writable && !load_index())) {
+        const int error = errno;
+        close();
+        errno = error;
+        return false;
+    }
+    m_data_size = st.st_size;
+    return true;
+}
+
+/**
+ * Close the shard's files and forget its keys
+ */
+void FleetShard::close()
+{
+    if(m_open) {
+        if(m_keys_fd >= 0) {
+            ::close(m_keys_fd);
+        }
+        if(m_data_fd >= 0) {
+            ::close(m_data_fd);
+        }
+        if(m_index_fd >= 0) {
+            ::close(m_index_fd);
+        }
+        free(m_keys);
+        free(m_table);
+        memset(this, 0, sizeof(*this));
+    }
+}
+
+/**
+ * Look up a battery
+ *
+ * @return Its key, -1 if it has none
+ */
+int64_t FleetShard::find_key(const char * host, const char * battery) const
+{
+    if(m_table_size == 0) {
+        return -1;
+    }
+    const uint32_t mask = m_table_size - 1;
+    for(uint32_t i = hash_key(host, battery) & mask; m_table[i]; i = (i + 1) & mask) {
+        const FleetKey & key = m_keys[m_table[i] - 1];
+        if((strcmp(key.host, host) == 0) && (strcmp(key.battery, battery) == 0)) {
+            return m_table[i] - 1;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Add a battery, in memory only
+ *
+ * @return Its key, -1 if out of memory
+ */
+int64_t FleetShard::add_key(const char * host, const char * battery,
+        const char * model)
+{
+    if(m_num_keys == m_keys_size) {
+        const uint32_t size = m_keys_size ? 2 * m_keys_size : 64;
+        FleetKey * keys = static_cast<FleetKey *>(realloc(m_keys, sizeof(FleetKey) * size));
+        if(!keys) {
+            return -1;
+        }
+        m_keys = keys;
+        m_keys_size = size;
+    }
+    /* Kept at most half full */
+    if(2 * (m_num_keys + 1) > m_table_size) {
+        const uint32_t size = m_table_size ? 2 * m_table_size : 128;
+        uint32_t * table = static_cast<uint32_t *>(calloc(size, sizeof(uint32_t)));
+        if(!table) {
+            return -1;
+        }
+        for(uint32_t k = 0; k < m_num_keys; k++) {
+            uint32_t i = hash_key(m_keys[k].host, m_keys[k].battery) & (size - 1);
+            while(table[i]) {
+                i = (i + 1) & (size - 1);
+            }
+            table[i] = k + 1;
+        }
+        free(m_table);
+        m_table = table;
+        m_table_size = size;
+    }
+
+    const uint32_t k = m_num_keys++;
+    FleetKey & key = m_keys[k];
+    memset(&key, 0, sizeof(key));
+    strncpy(key.host, host, FLEET_MAX_NAME);
+    strncpy(key.battery, battery, FLEET_MAX_NAME);
+    strncpy(key.model, model, FLEET_MAX_NAME);
+    uint32_t i = hash_key(key.host, key.battery) & (m_table_size - 1);
+    while(m_table[i]) {
+        i = (i + 1) & (m_table_size - 1);
+    }
+    m_table[i] = k + 1;
+    return k;
+}
+
+/**
+ * Read the keys file
+ *
+ * @return false if out of memory
+ */
+bool FleetShard::load_keys()
+{
+    size_t length;
+    char * data = read_all(m_keys_fd, &length);
+    if(!data) {
+        return false;
+    }
+    bool ok = true;
+    char * line = data;
+    char * end;
+    while(ok && (end = strchr(line, '\n'))) {
+        *end = '\0';
+        char * battery = strchr(line, '\t');
+        char * model = battery ? strchr(battery + 1, '\t') : NULL;
+        if(model) {
+            *battery++ = '\0';
+            *model++ = '\0';
+            const int64_t k = find_key(line, battery);
+            if(k >= 0) {
+                strncpy(m_keys[k].model, model, FLEET_MAX_NAME);
+            }
+            else {
+                ok = add_key(line, battery, model) >= 0;
+            }
+        }
+        line = end + 1;
+    }
+    free(data);
+    return ok;
+}
+
+/**
+ * Read the index for when each battery's last segment ended, dropping any
+ * partly written entry
+ *
+ * @return false if out of memory
+ */
+bool FleetShard::load_index()
+{
+    FleetIndexEntry * entries;
+    const size_t num = read_index(&entries);
+    if(!entries) {
+        return false;
+    }
+    for(size_t i = 0; i < num; i++) {
+        if(entries[i].key < m_num_keys) {
+            FleetKey & key = m_keys[entries[i].key];
+            if(entries[i].last_real > key.last_real) {
+                key.last_real = entries[i].last_real;
+            }
+        }
+    }
+    free(entries);
+    m_index_size = num * sizeof(FleetIndexEntry);
+    return ftruncate(m_index_fd, m_index_size) == 0;
+}
+
+/**
+ * Copy the samples of a segment after a time into a new segment
+ *
+ * @param[in] segment The segment
+ * @param[in] length Its size
+ * @param[in] after The time
+ * @param[out] writer The new segment
+ *
+ * @return The number of samples copied, -1 if the segment is corrupt
+ */
+static int64_t copy_after(const uint8_t * segment, size_t length, int64_t after,
+        HistoryWriter * writer)
+{
+    HistoryReader reader;
+    if(!reader.open(segment, length)) {
+        return -1;
+    }
+    writer->reset();
+    HistorySample sample;
+    while(reader.next(&sample)) {
+        if((sample.real_time > after) && !writer->append(sample)) {
+            return -1;
+        }
+    }
+    return writer->count();
+}
+
+/**
+ * Store an upload, synced to disk so it is safe to acknowledge. The samples
+ * up to the end of the battery's latest segment are dropped, so a resend
+ * (the client missed the reply), even with more samples added since, is
+ * only stored once.
+ *
+ * @param[in] upload The upload, already checked by fleet_decode()
+ *
+ * @return true if stored (or already stored)
+ */
+bool FleetShard::append(const FleetUpload & upload)
+{
+    FleetIndexEntry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.length = upload.segment_length;
+    if(!history_segment_info(upload.segment, upload.segment_length, &entry.count,
+                &entry.first_real, &entry.last_real)) {
+        return false;
+    }
+
+    const uint8_t * segment = upload.segment;
+    int64_t k = find_key(upload.host, upload.battery);
+    HistoryWriter writer;
+    if((k >= 0) && (entry.first_real <= m_keys[k].last_real)) {
+        const int64_t kept = copy_after(segment, entry.length, m_keys[k].last_real,
+                &writer);
+        if(kept <= 0) {
+            return kept == 0;
+        }
+        entry.length = writer.finish(&segment);
+        if(!history_segment_info(segment, entry.length, &entry.count,
+                    &entry.first_real, &entry.last_real)) {
+            return false;
+        }
+    }
+    if((k < 0) || (strcmp(m_keys[k].model, upload.model) != 0)) {
+        char line[3 * (FLEET_MAX_NAME + 1)];
+        const int length = snprintf(line, sizeof(line), "%s\t%s\t%s\n",
+                upload.host, upload.battery, upload.model);
+        if(!write_all(m_keys_fd, line, length) || (fdatasync(m_keys_fd) != 0)) {
+            return false;
+        }
+        if(k < 0) {
+            k = add_key(upload.host, upload.battery, upload.model);
+        }
+        else {
+            strcpy(m_keys[k].model, upload.model);
+        }
+        if(k < 0) {
+            return false;
+        }
+    }
+
+    /* The key and segment on disk before the index entry refers to them */
+    entry.key = k;
+    entry.offset = m_data_size;
+    if(!write_all(m_data_fd, reinterpret_cast<const char *>(segment), entry.length)
+            || (fdatasync(m_data_fd) != 0)) {
+        ftruncate(m_data_fd, m_data_size);
+        return false;
+    }
+    m_data_size += entry.length;
+    if(!write_all(m_index_fd, reinterpret_cast<const char *>(&entry), sizeof(entry))
+            || (fdatasync(m_index_fd) != 0)) {
+        ftruncate(m_index_fd, m_index_size);
+        return false;
+    }
+    m_index_size += sizeof(entry);
+    if(entry.last_real > m_keys[k].last_real) {
+        m_keys[k].last_real = entry.last_real;
+    }
+    return true;
+}
+
+/**
+ * Read the whole index
+ *
+ * @param[out] entries Set to the entries (free() it), NULL if out of memory
+ *
+ * @return The number of entries
+ */
+size_t FleetShard::read_index(FleetIndexEntry ** entries) const
+{
+    size_t length = 0;
+    *entries = reinterpret_cast<FleetIndexEntry *>(read_all(m_index_fd, &length));
+    return *entries ? length / sizeof(FleetIndexEntry) : 0;
+}
+
+/**
+ * Map the segments in to memory
+ *
+ * @param[out] length Set to the size of the mapping
+ *
+ * @return The mapping (munmap() it), NULL if empty or it can't be mapped
+ */
+const uint8_t * FleetShard::map_data(size_t * length) const
+{
+    struct stat st;
+    if((fstat(m_data_fd, &st) != 0) || (st.st_size == 0)) {
+        return NULL;
+    }
+    void * map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, m_data_fd, 0);
+    if(map == MAP_FAILED) {
+        return NULL;
+    }
+    *length = st.st_size;
+    return static_cast<const uint8_t *>(map);
+}
+
+/**
+ * The FleetStore constructor
+ *
+ * @param[in] dir The store directory
+ */
+FleetStore::FleetStore(const char * dir)
+{
+    m_dir = dir;
+}
+
+/**
+ * Store an upload in its host's shard
+ *
+ * @return true if stored (or already stored)
+ */
+bool FleetStore::append(const FleetUpload & upload)
+{
+    const unsigned i = fleet_shard_of(upload.host);
+    if(!m_shards[i].is_open() && !m_shards[i].open(m_dir, i, true)) {
+        if((errno != ENOENT) || (mkdir(m_dir, 0755) != 0)
+                || !m_shards[i].open(m_dir, i, true)) {
+            return false;
+        }
+    }
+    return m_shards[i].append(upload);
+}
+
+/**
+ * Find (or add) a model
+ */
+static ModelRates * find_model(FleetTotals * totals, const char * model)
+{
+    if(!model[0]) {
+        model = "unknown";
+    }
+    for(int i = 0; i < totals->num_models; i++) {
+        if(strcmp(totals->models[i].model, model) == 0) {
+            return &totals->models[i];
+        }
+    }
+    if(totals->num_models == totals->models_size) {
+        const int size = totals->models_size ? 2 * totals->models_size : 16;
+        ModelRates * models = static_cast<ModelRates *>(realloc(totals->models,
+                    sizeof(ModelRates) * size));
+        if(!models) {
+            return NULL;
+        }
+        totals->models = models;
+        totals->models_size = size;
+    }
+    ModelRates * found = &totals->models[totals->num_models++];
+    memset(found, 0, sizeof(*found));
+    snprintf(found->model, sizeof(found->model), "%s", model);
+    return found;
+}
+
+/**
+ * Make sure the scratch columns can hold a segment
+ */
+static bool reserve_columns(FleetTotals * totals, size_t count)
+{
+    if(count <= totals->columns_size) {
+        return true;
+    }
+    HistoryColumns & columns = totals->columns;
+    free(columns.real_time);
+    free(columns.up_time);
+    free(columns.status);
+    free(columns.capacity);
+    free(columns.volts);
+    columns.real_time = static_cast<int64_t *>(malloc(sizeof(int64_t) * count));
+    columns.up_time = static_cast<int64_t *>(malloc(sizeof(int64_t) * count));
+    columns.status = static_cast<uint8_t *>(malloc(count));
+    columns.capacity = static_cast<int64_t *>(malloc(sizeof(int64_t) * count));
+    columns.volts = static_cast<int64_t *>(malloc(sizeof(int64_t) * count));
+    totals->columns_size = count;
+    if(!columns.real_time || !columns.up_time || !columns.status
+            || !columns.capacity || !columns.volts) {
+        totals->columns_size = 0;
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Add the discharge rates of a segment to its model
+ */
+static void gather_rates(FleetTotals * totals, ModelRates * model,
+        const uint8_t * data, size_t length, const FleetIndexEntry & entry)
+{
+    HistoryReader reader;
+    if((entry.offset + entry.length > length)
+            || !reader.open(data + entry.offset, entry.length)
+            || !reserve_columns(totals, entry.count)) {
+        return;
+    }
+    const size_t count = reader.read_columns(totals->columns, entry.count);
+    if(model->count + count > model->size) {
+        const size_t size = (model->count + count) * 2;
+        int64_t * rates = static_cast<int64_t *>(realloc(model->rates,
+                    sizeof(int64_t) * size));
+        if(!rates) {
+            return;
+        }
+        model->rates = rates;
+        model->size = size;
+    }
+    for(size_t i = 1; i < count; i++) {
+        int64_t used, period;
+        if(history_discharge_rate(totals->columns, i, &used, &period)) {
+            model->rates[model->count++] = used / period;
+        }
+    }
+}
+
+static int by_host(const void * a, const void * b)
+{
+    return strcmp(*static_cast<const char * const *>(a),
+            *static_cast<const char * const *>(b));
+}
+
+/**
+ * Add up a shard
+ */
+static void scan_shard(FleetTotals * totals, const FleetShard & shard, bool rates)
+{
+    const uint32_t num_keys = shard.num_keys();
+    const char ** hosts = static_cast<const char **>(malloc(sizeof(char *) * (num_keys + 1)));
+    ModelRates ** models = static_cast<ModelRates **>(calloc(num_keys + 1,
+                sizeof(ModelRates *)));
+    if(!hosts || !models) {
+        free(hosts);
+        free(models);
+        return;
+    }
+    /* A host's batteries are all in its shard */
+    for(uint32_t k = 0; k < num_keys; k++) {
+        hosts[k] = shard.key(k).host;
+    }
+    qsort(hosts, num_keys, sizeof(char *), by_host);
+    for(uint32_t k = 0; k < num_keys; k++) {
+        totals->hosts += (k == 0) || (strcmp(hosts[k], hosts[k-1]) != 0);
+    }
+    totals->batteries += num_keys;
+
+    size_t length = 0;
+    const uint8_t * data = rates ? shard.map_data(&length) : NULL;
+    FleetIndexEntry * entries;
+    const size_t num = shard.read_index(&entries);
+    for(size_t i = 0; i < num; i++) {
+        totals->batches++;
+        totals->samples += entries[i].count;
+        const uint32_t k = entries[i].key;
+        if(data && (k < num_keys)) {
+            if(!models[k]) {
+                models[k] = find_model(totals, shard.key(k).model);
+                if(models[k]) {
+                    models[k]->batteries++;
+                }
+            }
+            if(models[k]) {
+                gather_rates(totals, models[k], data, length, entries[i]);
+            }
+        }
+    }
+    if(data) {
+        munmap(const_cast<uint8_t *>(data), length);
+    }
+    free(entries);
+    free(hosts);
+    free(models);
+}
+
+static int by_rate(const void * a, const void * b)
+{
+    const int64_t rate_a = *static_cast<const int64_t *>(a);
+    const int64_t rate_b = *static_cast<const int64_t *>(b);
+    return rate_a < rate_b ? -1 : rate_a > rate_b ? 1 : 0;
+}
+
+static int by_model(const void * a, const void * b)
+{
+    return strcmp(static_cast<const ModelRates *>(a)->model,
+            static_cast<const ModelRates *>(b)->model);
+}
+
+/**
+ * A percentile, by nearest rank, of sorted rates in W
+ */
+static double percentile(const int64_t * rates, size_t count, int percent)
+{
+    const size_t rank = (count * percent + 99) / 100;
+    return rates[rank > 0 ? rank - 1 : 0] / 1e6;
+}
+
+/**
+ * Answer a fleet wide query over the whole store
+ *
+ *     stats   hosts <n> batteries <n> batches <n> samples <n>
+ *     rates   a line per battery model of the discharge rates (W), over
+ *             every clean discharge interval of every battery of the model:
+ *             model, batteries, intervals, P50, P95 and max, tab separated
+ *
+ * @param[in] store The store directory
+ * @param[in] query The query
+ * @param[in] out Where to write the answer
+ *
+ * @return false if not a query
+ */
+bool fleet_store_query(const char * store, const char * query, FILE * out)
+{
+    const bool rates = strcmp(query, "rates") == 0;
+    if(!rates && (strcmp(query, "stats") != 0)) {
+        return false;
+    }
+    FleetTotals totals;
+    memset(&totals, 0, sizeof(totals));
+    FleetShard shard;
+    for(unsigned i = 0; i < FLEET_SHARDS; i++) {
+        if(shard.open(store, i, false)) {
+            scan_shard(&totals, shard, rates);
+        }
+    }
+    shard.close();
+
+    if(!rates) {
+        fprintf(out, "hosts %u batteries %u batches %llu samples %llu\n",
+                totals.hosts, totals.batteries,
+                static_cast<unsigned long long>(totals.batches),
+                static_cast<unsigned long long>(totals.samples));
+    }
+    else if(totals.num_models > 0) {
+        qsort(totals.models, totals.num_models, sizeof(ModelRates), by_model);
+    }
+    for(int i = 0; i < totals.num_models; i++) {
+        ModelRates & model = totals.models[i];
+        if(model.count > 0) {
+            qsort(model.rates, model.count, sizeof(int64_t), by_rate);
+            fprintf(out, "%s\t%u\t%zu\t%.3f\t%.3f\t%.3f\n", model.model,
+                    model.batteries, model.count,
+                    percentile(model.rates, model.count, 50),
+                    percentile(model.rates, model.count, 95),
+                    model.rates[model.count - 1] / 1e6);
+        }
+        free(model.rates);
+    }
+    free(totals.models);
+    free(totals.columns.real_time);
+    free(totals.columns.up_time);
+    free(totals.columns.status);
+    free(totals.columns.capacity);
+    free(totals.columns.volts);
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef _FLEET_STORE_H_
+#define _FLEET_STORE_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * The collector's store. Hosts are sharded, by a hash of their name, over
+ * FLEET_SHARDS shards, each three append only files:
+ *
+ *     <shard>.keys    A "host\tbattery\tmodel" line for each battery, the
+ *                     line number is its key. Added to again if the model
+ *                     changes, the last one wins.
+ *     <shard>.data    The uploaded segments, as they arrive
+ *     <shard>.index   A FleetIndexEntry for each segment in data
+ *
+ * So an upload is two appends to files the collector keeps open, however
+ * many hosts there are, rather than files per host to create and open. A
+ * key and a segment are synced to disk before the index entry that refers
+ * to them is written, and that before the upload is acknowledged, so a
+ * crash part way leaves at most some unused bytes on the end. The end of
+ * each battery's latest segment is kept in memory, to drop the samples of
+ * a resend that are already stored.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fleet.h"
+
+#define FLEET_STORE "/var/lib/batt_collector"
+#define FLEET_SHARDS 256
+
+/**
+ * An entry in a shard's index, in the collector's byte order
+ */
+struct FleetIndexEntry
+{
+    uint64_t offset;            /* Of the segment in data */
+    uint32_t length;
+    uint32_t count;             /* Samples */
+    uint32_t key;
+    uint32_t reserved;
+    int64_t first_real;
+    int64_t last_real;
+};
+
+/**
+ * A battery of a host
+ */
+struct FleetKey
+{
+    char host[FLEET_MAX_NAME + 1];
+    char battery[FLEET_MAX_NAME + 1];
+    char model[FLEET_MAX_NAME + 1];
+    int64_t last_real;          /* Latest end of the segments stored, 0 if none */
+};
+
+/**
+ * One shard of the store
+ */
+class FleetShard
+{
+private:
+    bool m_open;
+    int m_keys_fd;
+    int m_data_fd;
+    int m_index_fd;
+    uint64_t m_data_size;
+    uint64_t m_index_size;
+    FleetKey * m_keys;
+    uint32_t m_num_keys;
+    uint32_t m_keys_size;
+    uint32_t * m_table;         /* Hash of host and battery to key + 1 */
+    uint32_t m_table_size;      /* Always a power of 2 */
+
+    bool load_keys();
+    bool load_index();
+    int64_t find_key(const char * host, const char * battery) const;
+    int64_t add_key(const char * host, const char * battery, const char * model);
+public:
+    FleetShard();
+    ~FleetShard();
+    bool open(const char * store, unsigned shard, bool writable);
+    void close();
+    bool is_open() const {return m_open;};
+    bool append(const FleetUpload & upload);
+    uint32_t num_keys() const {return m_num_keys;};
+    const FleetKey & key(uint32_t i) const {return m_keys[i];};
+    size_t read_index(FleetIndexEntry ** entries) const;
+    const uint8_t * map_data(size_t * length) const;
+};
+
+/**
+ * The whole store, the shards opened as they are needed
+ */
+class FleetStore
+{
+private:
+    const char * m_dir;
+    FleetShard m_shards[FLEET_SHARDS];
+public:
+    FleetStore(const char * dir);
+    bool append(const FleetUpload & upload);
+};
+
+unsigned fleet_shard_of(const char * host);
+bool fleet_store_query(const char * store, const char * query, FILE * out);
+
+#endif
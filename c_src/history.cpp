@@ -0,0 +1,860 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "history.h"
+
+#define HISTORY_MAGIC "BCH1"
+#define HISTORY_VERSION 2
+
+/* Resolution of the values in data.log, so sealing loses nothing */
+#define CAPACITY_QUANTUM 100000     /* 0.1 J */
+#define VOLTS_QUANTUM 10000         /* 10 mV */
+
+/* Limit on a sealed segment, data.log is sealed before it reaches this */
+#define MAX_SEGMENT_SAMPLES 65536
+
+/* An exception in a block, which field and sample in a byte then the value */
+#define EXCEPTION_BYTES 5
+
+/* Change in real time - up time (secs) allowed without it being a suspend */
+#define MAX_OFFSET_JITTER 1
+
+/* Shortest gap between samples used for the rates */
+#define MIN_RATE_PERIOD 60
+
+static const char status_chars[] = {'/', '\\', '-'};
+
+static uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+/**
+ * Get the size class of a field, 0, 1, 2 or 4 bytes
+ *
+ * @param[in] value The field value
+ *
+ * @return The class (0 to 3), or -1 if it is too big
+ */
+static int field_class(uint64_t value)
+{
+    if(value == 0) {
+        return 0;
+    }
+    if(value < (1ull << 8)) {
+        return 1;
+    }
+    if(value < (1ull << 16)) {
+        return 2;
+    }
+    if(value < (1ull << 32)) {
+        return 3;
+    }
+    return -1;
+}
+
+/**
+ * Get the size in bytes of a field from its class
+ */
+static inline unsigned field_size(unsigned cls)
+{
+    return (0x4210 >> (4 * cls)) & 0xF;
+}
+
+static inline uint32_t load_le16(const uint8_t * data)
+{
+    uint16_t value;
+    memcpy(&value, data, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap16(value);
+#endif
+    return value;
+}
+
+static inline uint32_t load_le32(const uint8_t * data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof(value));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    value = __builtin_bswap32(value);
+#endif
+    return value;
+}
+
+static void put_le(uint8_t * data, uint64_t value, int bytes)
+{
+    for(int i = 0; i < bytes; i++) {
+        data[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+static uint64_t get_le(const uint8_t * data, int bytes)
+{
+    uint64_t value = 0;
+    for(int i = bytes - 1; i >= 0; i--) {
+        value = (value << 8) | data[i];
+    }
+    return value;
+}
+
+/**
+ * Round to the nearest multiple of quantum
+ *
+ * @return The number of quanta
+ */
+static int64_t quantize(int64_t value, int64_t quantum)
+{
+    if(value < 0) {
+        return -((quantum / 2 - value) / quantum);
+    }
+    return (value + quantum / 2) / quantum;
+}
+
+/**
+ * Unpack one field of a block into the column it becomes. A loop for each
+ * size, so the compiler can vectorise them.
+ *
+ * @param[in] data The field's values
+ * @param[in] cls Their size class
+ * @param[in] num The number of values
+ * @param[out] column The column
+ */
+static inline void unpack_field(const uint8_t * data, unsigned cls, uint32_t num,
+        int64_t * column)
+{
+    switch(cls)
+    {
+        case 0:
+            for(uint32_t i = 0; i < num; i++) {
+                column[i] = 0;
+            }
+            break;
+
+        case 1:
+            for(uint32_t i = 0; i < num; i++) {
+                column[i] = data[i];
+            }
+            break;
+
+        case 2:
+            for(uint32_t i = 0; i < num; i++) {
+                column[i] = load_le16(data + 2 * i);
+            }
+            break;
+
+        default:
+            for(uint32_t i = 0; i < num; i++) {
+                column[i] = load_le32(data + 4 * i);
+            }
+            break;
+    }
+}
+
+/**
+ * The HistoryWriter constructor
+ */
+HistoryWriter::HistoryWriter()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+/**
+ * The HistoryWriter destructor
+ */
+HistoryWriter::~HistoryWriter()
+{
+    free(m_buf);
+}
+
+/**
+ * Empty the writer, ready for a new segment
+ */
+void HistoryWriter::reset()
+{
+    if(m_buf) {
+        memset(m_buf, 0, m_size);
+    }
+    m_pos = 0;
+    m_count = 0;
+    m_block_count = 0;
+}
+
+/**
+ * Make sure there is room for more bytes
+ *
+ * @param[in] bytes The number of bytes to add
+ *
+ * @return false if out of memory
+ */
+bool HistoryWriter::reserve(size_t bytes)
+{
+    const size_t need = HISTORY_HEADER_SIZE + m_pos + bytes;
+    if(need > m_size) {
+        size_t size = m_size ? 2 * m_size : 4096;
+        while(size < need) {
+            size *= 2;
+        }
+        uint8_t * buf = static_cast<uint8_t *>(realloc(m_buf, size));
+        if(!buf) {
+            return false;
+        }
+        memset(buf + m_size, 0, size - m_size);
+        m_buf = buf;
+        m_size = size;
+    }
+    return true;
+}
+
+/**
+ * Write out the block of samples so far. Each field is at the size that
+ * takes fewest bytes, counting the values too big for it, which are stored
+ * whole as exceptions after the fields.
+ *
+ * @return false if out of memory
+ */
+bool HistoryWriter::flush_block()
+{
+    const uint32_t num = m_block_count;
+    if(num == 0) {
+        return true;
+    }
+    unsigned ctrl = 0;
+    int classes[4];
+    size_t bytes = 2;
+    unsigned exceptions = 0;
+    for(int i = 0; i < 4; i++) {
+        uint32_t counts[4] = {0, 0, 0, 0};
+        for(uint32_t j = 0; j < num; j++) {
+            counts[field_class(m_block[i][j])]++;
+        }
+        /* Try each size, with the values bigger than it as exceptions */
+        size_t best = 0;
+        unsigned bigger = num - counts[0];
+        for(int cls = 0; cls < 4; cls++) {
+            const size_t size = num * field_size(cls) + bigger * EXCEPTION_BYTES;
+            if((cls == 0) || (size < best)) {
+                best = size;
+                classes[i] = cls;
+            }
+            if(cls < 3) {
+                bigger -= counts[cls + 1];
+            }
+        }
+        ctrl |= classes[i] << (2 * i);
+        bytes += best;
+        for(int cls = classes[i] + 1; cls < 4; cls++) {
+            exceptions += counts[cls];
+        }
+    }
+    if(!reserve(bytes)) {
+        return false;
+    }
+    uint8_t * data = m_buf + HISTORY_HEADER_SIZE + m_pos;
+    *data++ = ctrl;
+    for(int i = 0; i < 4; i++) {
+        const uint32_t limit = classes[i] < 3 ? 1u << (8 * field_size(classes[i])) : 0;
+        const unsigned size = field_size(classes[i]);
+        for(uint32_t j = 0; j < num; j++) {
+            put_le(data, (limit == 0) || (m_block[i][j] < limit) ? m_block[i][j] : 0, size);
+            data += size;
+        }
+    }
+    *data++ = exceptions;
+    for(int i = 0; i < 4; i++) {
+        const uint32_t limit = classes[i] < 3 ? 1u << (8 * field_size(classes[i])) : 0;
+        for(uint32_t j = 0; (limit != 0) && (j < num); j++) {
+            if(m_block[i][j] >= limit) {
+                *data++ = (i << 5) | j;
+                put_le(data, m_block[i][j], 4);
+                data += 4;
+            }
+        }
+    }
+    m_pos += bytes;
+    m_block_count = 0;
+    return true;
+}
+
+/**
+ * Add a sample to the segment
+ *
+ * @param[in] sample The sample
+ *
+ * @return false if the sample can't be added (the segment is full, or the
+ *      change from the last sample is too big), start a new segment
+ */
+bool HistoryWriter::append(const HistorySample & sample)
+{
+    if(m_count >= MAX_SEGMENT_SAMPLES) {
+        return false;
+    }
+    HistoryState next;
+    next.up_time = sample.up_time;
+    next.offset = sample.real_time - sample.up_time;
+    next.status = sample.status;
+    next.capacity = quantize(sample.capacity.micro(), CAPACITY_QUANTUM);
+    next.volts = quantize(sample.volts.micro(), VOLTS_QUANTUM);
+
+    if(m_count == 0) {
+        m_first = sample;
+        next.up_delta = 0;
+        next.capacity_delta = 0;
+    }
+    else {
+        next.up_delta = next.up_time - m_last.up_time;
+        next.capacity_delta = next.capacity - m_last.capacity;
+
+        const uint64_t offset = zigzag(next.offset - m_last.offset);
+        if(offset >= (1ull << 30)) {
+            return false;
+        }
+        uint64_t fields[4];
+        fields[0] = zigzag(next.up_delta - m_last.up_delta);
+        fields[1] = (offset << 2) | (next.status ^ m_last.status);
+        fields[2] = zigzag(next.capacity_delta - m_last.capacity_delta);
+        fields[3] = zigzag(next.volts - m_last.volts);
+        for(int i = 0; i < 4; i++) {
+            if(field_class(fields[i]) < 0) {
+                return false;
+            }
+            m_block[i][m_block_count] = fields[i];
+        }
+        m_block_count++;
+        if((m_block_count == HISTORY_BLOCK) && !flush_block()) {
+            m_block_count--;
+            return false;
+        }
+    }
+    m_last = next;
+    m_count++;
+    return true;
+}
+
+/**
+ * Fill in the header and get the finished segment. Call reset() before
+ * appending any more.
+ *
+ * @param[out] data Set to the segment, owned by the writer
+ *
+ * @return The size of the segment in bytes, 0 if empty
+ */
+size_t HistoryWriter::finish(const uint8_t ** data)
+{
+    if((m_count == 0) || !flush_block() || !reserve(0)) {
+        return 0;
+    }
+    uint8_t * header = m_buf;
+    memcpy(header, HISTORY_MAGIC, 4);
+    put_le(header + 4, HISTORY_VERSION, 2);
+    put_le(header + 6, HISTORY_HEADER_SIZE, 2);
+    put_le(header + 8, m_count, 4);
+    put_le(header + 12, m_pos, 4);
+    put_le(header + 16, m_first.real_time, 8);
+    put_le(header + 24, m_first.up_time, 8);
+    put_le(header + 32, m_last.up_time + m_last.offset, 8);
+    put_le(header + 40, quantize(m_first.capacity.micro(), CAPACITY_QUANTUM), 8);
+    put_le(header + 48, quantize(m_first.volts.micro(), VOLTS_QUANTUM), 4);
+    put_le(header + 52, CAPACITY_QUANTUM, 4);
+    put_le(header + 56, VOLTS_QUANTUM, 4);
+    header[60] = m_first.status;
+    *data = m_buf;
+    return HISTORY_HEADER_SIZE + m_pos;
+}
+
+/**
+ * Check a segment header
+ *
+ * @return true if it looks like a segment we can decode
+ */
+static bool check_header(const uint8_t * data, size_t length)
+{
+    return (length >= HISTORY_HEADER_SIZE)
+        && (memcmp(data, HISTORY_MAGIC, 4) == 0)
+        && (get_le(data + 4, 2) == HISTORY_VERSION)
+        && (get_le(data + 6, 2) == HISTORY_HEADER_SIZE)
+        && (get_le(data + 12, 4) <= length - HISTORY_HEADER_SIZE)
+        && (get_le(data + 52, 4) == CAPACITY_QUANTUM)
+        && (get_le(data + 56, 4) == VOLTS_QUANTUM)
+        && (data[60] <= HISTORY_IDLE);
+}
+
+/**
+ * Get the number of samples and time range of a segment without decoding it
+ *
+ * @param[in] data The segment
+ * @param[in] length Its size in bytes
+ * @param[out] count The number of samples
+ * @param[out] first_real The real time of the first sample
+ * @param[out] last_real The real time of the last sample
+ *
+ * @return false if not a valid segment
+ */
+bool history_segment_info(const uint8_t * data, size_t length,
+        uint32_t * count, int64_t * first_real, int64_t * last_real)
+{
+    if(!check_header(data, length)) {
+        return false;
+    }
+    *count = get_le(data + 8, 4);
+    *first_real = get_le(data + 16, 8);
+    *last_real = get_le(data + 32, 8);
+    return true;
+}
+
+/**
+ * The HistoryReader constructor
+ */
+HistoryReader::HistoryReader()
+{
+    memset(this, 0, sizeof(*this));
+}
+
+/**
+ * Start decoding a segment
+ *
+ * @param[in] data The segment
+ * @param[in] length Its size in bytes
+ *
+ * @return false if not a valid segment
+ */
+bool HistoryReader::open(const uint8_t * data, size_t length)
+{
+    m_remaining = 0;
+    m_next = 0;
+    m_buffered = 0;
+    if(!check_header(data, length)) {
+        return false;
+    }
+    m_data = data + HISTORY_HEADER_SIZE;
+    m_end = get_le(data + 12, 4);
+    m_pos = 0;
+    /* Can't trust the count, decode_block() checks each block fits */
+    m_remaining = get_le(data + 8, 4);
+    if(m_remaining == 0) {
+        return true;
+    }
+    m_remaining--;
+
+    /* The first sample is all in the header */
+    m_state.up_time = get_le(data + 24, 8);
+    m_state.offset = get_le(data + 16, 8) - m_state.up_time;
+    m_state.up_delta = 0;
+    m_state.status = data[60];
+    m_state.capacity = get_le(data + 40, 8);
+    m_state.capacity_delta = 0;
+    m_state.volts = static_cast<int32_t>(get_le(data + 48, 4));
+    m_real_time[0] = m_state.up_time + m_state.offset;
+    m_up_time[0] = m_state.up_time;
+    m_status[0] = m_state.status;
+    m_capacity[0] = m_state.capacity * CAPACITY_QUANTUM;
+    m_volts[0] = m_state.volts * VOLTS_QUANTUM;
+    m_buffered = 1;
+    return true;
+}
+
+/**
+ * Decode the next block of samples. Each field is unpacked into the column
+ * it becomes, then each column is turned from deltas into values, so every
+ * loop is a short chain of adds at most.
+ *
+ * @param[in] columns Where to put the samples
+ *
+ * @return The number of samples decoded, 0 at the end or if corrupt
+ */
+uint32_t HistoryReader::decode_block(const HistoryColumns & columns)
+{
+    const uint32_t num = m_remaining < HISTORY_BLOCK ? m_remaining : HISTORY_BLOCK;
+    if((num == 0) || (m_pos >= m_end)) {
+        m_remaining = 0;
+        return 0;
+    }
+    const unsigned ctrl = m_data[m_pos];
+    size_t bytes = 2;
+    for(int i = 0; i < 4; i++) {
+        bytes += num * field_size((ctrl >> (2 * i)) & 3);
+    }
+    if(bytes <= m_end - m_pos) {
+        bytes += m_data[m_pos + bytes - 1] * EXCEPTION_BYTES;
+    }
+    if(bytes > m_end - m_pos) {
+        /* Corrupt, runs off the end */
+        m_remaining = 0;
+        return 0;
+    }
+
+    /* Locals, as stores to status (uint8_t) could alias the members */
+    HistoryState state = m_state;
+    int64_t * real_time = columns.real_time;
+    int64_t * up_time = columns.up_time;
+    uint8_t * status = columns.status;
+    int64_t * capacity = columns.capacity;
+    int64_t * volts = columns.volts;
+
+    const uint8_t * data = m_data + m_pos + 1;
+    unpack_field(data, ctrl & 3, num, up_time);
+    data += num * field_size(ctrl & 3);
+    unpack_field(data, (ctrl >> 2) & 3, num, real_time);
+    data += num * field_size((ctrl >> 2) & 3);
+    unpack_field(data, (ctrl >> 4) & 3, num, capacity);
+    data += num * field_size((ctrl >> 4) & 3);
+    unpack_field(data, ctrl >> 6, num, volts);
+    data += num * field_size(ctrl >> 6);
+
+    /* The values too big for their field's size */
+    int64_t * const fields[4] = {up_time, real_time, capacity, volts};
+    for(const uint8_t * end = data + 1 + *data * EXCEPTION_BYTES, * exception = data + 1;
+            exception < end; exception += EXCEPTION_BYTES) {
+        const uint32_t i = *exception & (HISTORY_BLOCK - 1);
+        if(i >= num) {
+            m_remaining = 0;
+            return 0;
+        }
+        fields[(*exception >> 5) & 3][i] = load_le32(exception + 1);
+    }
+
+    /* Then undo the zig-zag and sum up the deltas, all the columns in the
+     * one loop so their chains of adds run side by side */
+    for(uint32_t i = 0; i < num; i++) {
+        const uint64_t field = real_time[i];
+        state.up_delta += unzigzag(up_time[i]);
+        state.capacity_delta += unzigzag(capacity[i]);
+        state.volts += unzigzag(volts[i]);
+        state.offset += unzigzag(field >> 2);
+        state.status ^= field & 3;
+        state.up_time += state.up_delta;
+        state.capacity += state.capacity_delta;
+        up_time[i] = state.up_time;
+        real_time[i] = state.up_time + state.offset;
+        capacity[i] = state.capacity * CAPACITY_QUANTUM;
+        volts[i] = state.volts * VOLTS_QUANTUM;
+        status[i] = state.status;
+    }
+
+    m_state = state;
+    m_pos += bytes;
+    m_remaining -= num;
+    return num;
+}
+
+/**
+ * Decode the next sample
+ *
+ * @param[out] sample The sample
+ *
+ * @return false at the end of the segment
+ */
+bool HistoryReader::next(HistorySample * sample)
+{
+    if(m_next == m_buffered) {
+        HistoryColumns columns;
+        columns.real_time = m_real_time;
+        columns.up_time = m_up_time;
+        columns.status = m_status;
+        columns.capacity = m_capacity;
+        columns.volts = m_volts;
+        m_next = 0;
+        m_buffered = decode_block(columns);
+        if(m_buffered == 0) {
+            return false;
+        }
+    }
+    const uint32_t i = m_next++;
+    sample->real_time = m_real_time[i];
+    sample->up_time = m_up_time[i];
+    sample->status = m_status[i];
+    sample->capacity = MicroJoules(m_capacity[i]);
+    sample->volts = MicroVolts(m_volts[i]);
+    return true;
+}
+
+/**
+ * Decode the next samples into arrays, much faster than next()
+ *
+ * @param[in] columns The arrays to fill
+ * @param[in] max The size of the arrays
+ *
+ * @return The number of samples decoded
+ */
+size_t HistoryReader::read_columns(const HistoryColumns & columns, size_t max)
+{
+    size_t num = 0;
+    HistorySample sample;
+    /* What next() has decoded already */
+    while((num < max) && (m_next < m_buffered) && next(&sample)) {
+        columns.real_time[num] = sample.real_time;
+        columns.up_time[num] = sample.up_time;
+        columns.status[num] = sample.status;
+        columns.capacity[num] = sample.capacity.micro();
+        columns.volts[num] = sample.volts.micro();
+        num++;
+    }
+
+    /* Whole blocks straight into the arrays */
+    while((m_remaining > 0)
+            && (max - num >= (m_remaining < HISTORY_BLOCK ? m_remaining : HISTORY_BLOCK))) {
+        HistoryColumns at;
+        at.real_time = columns.real_time + num;
+        at.up_time = columns.up_time + num;
+        at.status = columns.status + num;
+        at.capacity = columns.capacity + num;
+        at.volts = columns.volts + num;
+        const uint32_t decoded = decode_block(at);
+        if(decoded == 0) {
+            break;
+        }
+        num += decoded;
+    }
+
+    /* Part of a block, through next() */
+    while((num < max) && next(&sample)) {
+        columns.real_time[num] = sample.real_time;
+        columns.up_time[num] = sample.up_time;
+        columns.status[num] = sample.status;
+        columns.capacity[num] = sample.capacity.micro();
+        columns.volts[num] = sample.volts.micro();
+        num++;
+    }
+    return num;
+}
+
+/**
+ * Check whether the interval up to a sample is a clean discharge, both ends
+ * discharging with no suspend between, that a rate can be worked out from
+ *
+ * @param[in] columns The decoded history
+ * @param[in] i The sample at the end of the interval, > 0
+ * @param[out] used The energy used over the interval (uJ)
+ * @param[out] period The length of the interval (secs)
+ *
+ * @return true if it is, the rate is used / period
+ */
+bool history_discharge_rate(const HistoryColumns & columns, size_t i,
+        int64_t * used, int64_t * period)
+{
+    if((columns.status[i] != HISTORY_DISCHARGING)
+            || (columns.status[i-1] != HISTORY_DISCHARGING)) {
+        return false;
+    }
+    *period = columns.up_time[i] - columns.up_time[i-1];
+    *used = columns.capacity[i-1] - columns.capacity[i];
+    const int64_t suspended = (columns.real_time[i] - columns.real_time[i-1])
+        - *period;
+    return (*period > MIN_RATE_PERIOD) && (suspended <= MAX_OFFSET_JITTER)
+        && (suspended >= -MAX_OFFSET_JITTER) && (*used >= 0);
+}
+
+/**
+ * Parse a line of data.log
+ *
+ * @param[in] line The line
+ * @param[out] sample The sample
+ *
+ * @return false if the line is not valid
+ */
+bool history_parse_line(const char * line, HistorySample * sample)
+{
+    char * end;
+    sample->real_time = strtoll(line, &end, 10);
+    if((end == line) || (*end != '\t')) {
+        return false;
+    }
+    line = end + 1;
+    sample->up_time = strtoll(line, &end, 10);
+    if((end == line) || (*end != '\t')) {
+        return false;
+    }
+    switch(end[1]) {
+        case '/':
+            sample->status = HISTORY_CHARGING;
+            break;
+
+        case '\\':
+            sample->status = HISTORY_DISCHARGING;
+            break;
+
+        case '-':
+            sample->status = HISTORY_IDLE;
+            break;
+
+        default:
+            return false;
+    }
+    if(end[2] != '\t') {
+        return false;
+    }
+    line = end + 3;
+    sample->capacity = MicroJoules(parse_micro(line, &end));
+    if((end == line) || (*end != '\t')) {
+        return false;
+    }
+    line = end + 1;
+    sample->volts = MicroVolts(parse_micro(line, &end));
+    return end != line;
+}
+
+/**
+ * Format a number of quanta as a decimal, as printf("%.Nf") would
+ *
+ * @param[in] quanta The value in quanta of 10^-decimals
+ * @param[in] decimals The number of decimal places (1 or 2)
+ * @param[out] buf The buffer for the number
+ * @param[in] maxlen The size of buf
+ */
+static void format_decimal(int64_t quanta, int decimals, char * buf, size_t maxlen)
+{
+    const int64_t scale = decimals == 1 ? 10 : 100;
+    const uint64_t magnitude = quanta < 0 ? -static_cast<uint64_t>(quanta) : quanta;
+    snprintf(buf, maxlen, "%s%" PRIu64 ".%0*" PRIu64, quanta < 0 ? "-" : "",
+            magnitude / scale, decimals, magnitude % scale);
+}
+
+/**
+ * Format a sample as a line of data.log
+ *
+ * @param[in] sample The sample
+ * @param[out] buf The buffer for the line
+ * @param[in] maxlen The size of buf
+ *
+ * @return As snprintf
+ */
+int history_format_line(const HistorySample & sample, char * buf, size_t maxlen)
+{
+    char capacity[32];
+    char volts[32];
+    format_decimal(quantize(sample.capacity.micro(), CAPACITY_QUANTUM), 1,
+            capacity, sizeof(capacity));
+    format_decimal(quantize(sample.volts.micro(), VOLTS_QUANTUM), 2,
+            volts, sizeof(volts));
+    const char status = (sample.status >= 0) && (sample.status <= HISTORY_IDLE)
+        ? status_chars[sample.status] : '?';
+    return snprintf(buf, maxlen, "%" PRId64 "\t%" PRId64 "\t%c\t%9s\t%s\n",
+            sample.real_time, sample.up_time, status, capacity, volts);
+}
+
+/**
+ * Write a segment to the history directory, named after its first sample
+ *
+ * @return false if it could not be written
+ */
+static bool write_segment(const char * seg_dir, const uint8_t * data,
+        size_t length)
+{
+    uint32_t count;
+    int64_t first_real, last_real;
+    if(!history_segment_info(data, length, &count, &first_real, &last_real)) {
+        return false;
+    }
+
+    char path[1024];
+    char tmp_path[1030];
+    snprintf(path, sizeof(path), "%s/%" PRId64 ".seg", seg_dir, first_real);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.new", path);
+
+    FILE * fp = fopen(tmp_path, "w");
+    if(!fp) {
+        return false;
+    }
+    const bool ok = (fwrite(data, 1, length, fp) == length);
+    if((fclose(fp) != 0) || !ok) {
+        unlink(tmp_path);
+        return false;
+    }
+    return rename(tmp_path, path) == 0;
+}
+
+/**
+ * Seal the text log into compressed segments in seg_dir, then empty it.
+ * A segment is named after its first sample, so if we die before the log
+ * is emptied the next seal just replaces it.
+ *
+ * @param[in] log_path The text log (data.log)
+ * @param[in] seg_dir The directory for the segments
+ *
+ * @return true if sealed
+ */
+bool history_seal(const char * log_path, const char * seg_dir)
+{
+    if((mkdir(seg_dir, 0755) != 0) && (errno != EEXIST)) {
+        return false;
+    }
+    FILE * fp = fopen(log_path, "r+");
+    if(!fp) {
+        return false;
+    }
+    flock(fileno(fp), LOCK_EX);
+
+    bool ok = true;
+    char line[256];
+    HistoryWriter writer;
+    while(ok && fgets(line, sizeof(line), fp)) {
+        HistorySample sample;
+        if(!history_parse_line(line, &sample)) {
+            continue;
+        }
+        if(!writer.append(sample)) {
+            const uint8_t * data;
+            const size_t length = writer.finish(&data);
+            ok = (length > 0) && write_segment(seg_dir, data, length);
+            writer.reset();
+            ok = ok && writer.append(sample);
+        }
+    }
+    if(ok && writer.count()) {
+        const uint8_t * data;
+        const size_t length = writer.finish(&data);
+        ok = (length > 0) && write_segment(seg_dir, data, length);
+    }
+
+    if(ok) {
+        ok = ftruncate(fileno(fp), 0) == 0;
+    }
+    fclose(fp);
+    return ok;
+}
+
+/**
+ * Only the segments, which are named after their first sample
+ */
+static int is_segment(const struct dirent * entry)
+{
+    const char * dot = strchr(entry->d_name, '.');
+    return dot && (strcmp(dot, ".seg") == 0);
+}
+
+static int by_time(const struct dirent ** a, const struct dirent ** b)
+{
+    const long long time_a = atoll((*a)->d_name);
+    const long long time_b = atoll((*b)->d_name);
+    return time_a < time_b ? -1 : time_a > time_b ? 1 : 0;
+}
+
+/**
+ * List the segments in a directory, oldest first
+ *
+ * @param[in] seg_dir The directory
+ * @param[out] entries Set to the list, free() each entry and the list
+ *
+ * @return The number of segments, -1 if the directory can't be read
+ */
+int history_scan_segments(const char * seg_dir, struct dirent *** entries)
+{
+    return scandir(seg_dir, entries, is_segment, by_time);
+}
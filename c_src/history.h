@@ -0,0 +1,154 @@
+#ifndef _HISTORY_H_
+#define _HISTORY_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Compressed history segments. The live history is the text data.log, once
+ * that gets big it is sealed into a segment: a fixed header holding the
+ * first sample, followed by the rest in blocks of HISTORY_BLOCK samples
+ * (the last can be short). Timestamps are delta-of-delta encoded (with the
+ * real time stored as its offset from the up time, which rarely changes,
+ * and the charging status XORed into the offset's low 2 bits), capacity is
+ * delta-of-delta and voltage delta, all zig-zagged. A block is a control
+ * byte giving the size of each of the four fields (0, 1, 2 or 4 bytes)
+ * followed by each field's values for the whole block, then the odd value
+ * too big for its field's size as an exception patched in after. So the
+ * common small changes take few bytes while staying byte aligned, and a
+ * block decodes a field at a time in loops of a fixed size, with no branch
+ * or wait on the size of each sample. A segment can be decoded on its own.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "units.h"
+
+#define HISTORY_HEADER_SIZE 64
+
+/* Samples in a block, after the first */
+#define HISTORY_BLOCK 32
+
+/* Charging status, as in data.log */
+enum HistoryStatus
+{
+    HISTORY_CHARGING = 0,       /* '/' */
+    HISTORY_DISCHARGING = 1,    /* '\' */
+    HISTORY_IDLE = 2            /* '-' */
+};
+
+/**
+ * One sample of history
+ */
+struct HistorySample
+{
+    int64_t real_time;
+    int64_t up_time;
+    int status;
+    MicroJoules capacity;
+    MicroVolts volts;
+};
+
+/**
+ * Decoded history as one array per field, for fast bulk access
+ */
+struct HistoryColumns
+{
+    int64_t * real_time;
+    int64_t * up_time;
+    uint8_t * status;
+    int64_t * capacity;         /* uJ */
+    int64_t * volts;            /* uV */
+};
+
+/**
+ * The encoder state after a sample, in the units stored in a segment
+ */
+struct HistoryState
+{
+    int64_t up_time;
+    int64_t up_delta;
+    int64_t offset;             /* real time - up time */
+    int status;
+    int64_t capacity;           /* quanta */
+    int64_t capacity_delta;
+    int64_t volts;              /* quanta */
+};
+
+/**
+ * Builds a segment a sample at a time
+ */
+class HistoryWriter
+{
+private:
+    uint8_t * m_buf;
+    size_t m_size;
+    size_t m_pos;
+    uint32_t m_count;
+    HistorySample m_first;
+    HistoryState m_last;
+    uint32_t m_block[4][HISTORY_BLOCK];     /* The fields of the block so far */
+    uint32_t m_block_count;
+
+    bool reserve(size_t bytes);
+    bool flush_block();
+public:
+    HistoryWriter();
+    ~HistoryWriter();
+    void reset();
+    bool append(const HistorySample & sample);
+    uint32_t count() const {return m_count;};
+    size_t finish(const uint8_t ** data);
+};
+
+/**
+ * Decodes a segment, a block at a time into columns, or a sample at a time
+ */
+class HistoryReader
+{
+private:
+    const uint8_t * m_data;
+    size_t m_pos;
+    size_t m_end;
+    uint32_t m_remaining;       /* Samples in the blocks not decoded yet */
+    HistoryState m_state;
+    /* The block next() is working through */
+    int64_t m_real_time[HISTORY_BLOCK];
+    int64_t m_up_time[HISTORY_BLOCK];
+    int64_t m_capacity[HISTORY_BLOCK];
+    int64_t m_volts[HISTORY_BLOCK];
+    uint8_t m_status[HISTORY_BLOCK];
+    uint32_t m_next;
+    uint32_t m_buffered;
+
+    uint32_t decode_block(const HistoryColumns & columns);
+public:
+    HistoryReader();
+    bool open(const uint8_t * data, size_t length);
+    uint32_t remaining() const {return m_remaining + m_buffered - m_next;};
+    bool next(HistorySample * sample);
+    size_t read_columns(const HistoryColumns & columns, size_t max);
+};
+
+/**
+ * Get the number of samples and time range of a segment without decoding it
+ */
+bool history_segment_info(const uint8_t * data, size_t length,
+        uint32_t * count, int64_t * first_real, int64_t * last_real);
+
+bool history_discharge_rate(const HistoryColumns & columns, size_t i,
+        int64_t * used, int64_t * period);
+
+bool history_parse_line(const char * line, HistorySample * sample);
+int history_format_line(const HistorySample & sample, char * buf, size_t maxlen);
+bool history_seal(const char * log_path, const char * seg_dir);
+
+struct dirent;
+int history_scan_segments(const char * seg_dir, struct dirent *** entries);
+
+#endif
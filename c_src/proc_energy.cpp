@@ -0,0 +1,780 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "proc_energy.h"
+#include "raw_io.h"
+
+/* Version of the state file layout */
+#define STATE_VERSION 2
+
+/* Largest state file read, about 50 bytes a process */
+#define MAX_STATE_SIZE (4 * 1024 * 1024)
+
+/* Longest line of the state file */
+#define MAX_STATE_LINE 128
+
+/* Changes every boot, in /proc */
+#define BOOT_ID_FILE "sys/kernel/random/boot_id"
+#define BOOT_ID_LEN 40
+
+/* Number of slots allocated on the first sample, grows as needed */
+#define INITIAL_SLOTS 1024
+
+/* Half life (in msecs) of the energy accumulated against a process */
+#define ENERGY_HALF_LIFE (3600 * 1000)
+
+/* Fixed point decay factors are Q16 */
+#define DECAY_SHIFT 16
+
+/*
+ * Weight of one CPU tick against one KiB of block IO. Roughly a tick
+ * of CPU costs about the same as moving a MiB to or from storage.
+ */
+#define TICK_WEIGHT 1024
+
+/* Don't let the fd cache raise the fd limit beyond this */
+#define MAX_FD_LIMIT 16384
+
+/* Fds held back for everything else the checker does */
+#define FD_RESERVE 64
+
+/* io_fd value meaning /proc/<pid>/io can't be read, so don't try again */
+#define FD_DENIED (-2)
+
+/**
+ * Number of fds we can keep open between samples
+ */
+static unsigned fd_budget = 0;
+static unsigned fds_open = 0;
+
+/**
+ * Raise the soft fd limit so the per-process fds can be cached
+ */
+static void init_fd_budget(void)
+{
+    struct rlimit lim;
+    if(getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+        rlim_t want = lim.rlim_max;
+        if((want == RLIM_INFINITY) || (want > MAX_FD_LIMIT)) {
+            want = MAX_FD_LIMIT;
+        }
+        if(want > lim.rlim_cur) {
+            lim.rlim_cur = want;
+            if(setrlimit(RLIMIT_NOFILE, &lim) != 0) {
+                getrlimit(RLIMIT_NOFILE, &lim);
+            }
+        }
+        if(lim.rlim_cur > FD_RESERVE) {
+            fd_budget = lim.rlim_cur - FD_RESERVE;
+        }
+    }
+}
+
+/**
+ * 2^(-i/16) in Q16, for the fractional part of the decay
+ */
+static const unsigned fraction_decay[16] = {
+    65536, 62757, 60097, 57549, 55109, 52773, 50535, 48393,
+    46341, 44376, 42495, 40693, 38968, 37316, 35734, 34219
+};
+
+/**
+ * Calculate the decay over elapsed time, 2^(-elapsed/half life), in Q16.
+ * Rounded to the nearest 1/16 of a half life which is plenty accurate.
+ *
+ * @param[in] elapsed The time in msecs
+ *
+ * @return The decay factor
+ */
+static unsigned calc_decay(int64_t elapsed)
+{
+    const int64_t sixteenths = (elapsed * 16 + ENERGY_HALF_LIFE / 2)
+        / ENERGY_HALF_LIFE;
+    if(sixteenths >= 16 * DECAY_SHIFT) {
+        return 0;
+    }
+    return fraction_decay[sixteenths % 16] >> (sixteenths / 16);
+}
+
+/**
+ * Apply a decay factor
+ */
+static MicroJoules apply_decay(MicroJoules joules, unsigned decay)
+{
+    return MicroJoules((joules.micro() * decay) >> DECAY_SHIFT);
+}
+
+/**
+ * Get the time now, in msecs. Monotonic, so it doesn't count suspend, when
+ * nothing runs.
+ */
+static int64_t now_msecs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+/**
+ * Read the id of this boot, "-" if it can't be read
+ *
+ * @param[in] proc_dir Where proc is mounted
+ * @param[out] boot_id The id, BOOT_ID_LEN bytes
+ */
+static void read_boot_id(const char * proc_dir, char * boot_id)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s/" BOOT_ID_FILE, proc_dir);
+    if(read_file(path, boot_id, BOOT_ID_LEN) > 0) {
+        boot_id[strcspn(boot_id, " \n")] = '\0';
+    }
+    else {
+        strcpy(boot_id, "-");
+    }
+}
+
+/**
+ * Copy a comm for the state file, where it ends the line and can't hold
+ * white space
+ */
+static void clean_comm(char * dest, const char * comm)
+{
+    size_t i;
+    for(i = 0; (i < PROC_COMM_LEN - 1) && comm[i]; i++) {
+        dest[i] = ((comm[i] > ' ') && (comm[i] < 0x7f)) ? comm[i] : '_';
+    }
+    dest[i] = '\0';
+}
+
+/**
+ * Read the comm at the end of a state file line
+ *
+ * @param[in,out] pos Where the comm starts, moved to the end of the line
+ * @param[out] comm The comm
+ */
+static void parse_comm(char ** pos, char * comm)
+{
+    char * start = *pos + strspn(*pos, " ");
+    size_t len = strcspn(start, "\n");
+    *pos = start + len;
+    if(len >= PROC_COMM_LEN) {
+        len = PROC_COMM_LEN - 1;
+    }
+    memcpy(comm, start, len);
+    comm[len] = '\0';
+}
+
+/**
+ * Hash a pid into the slot table
+ */
+static unsigned hash_pid(pid_t pid, unsigned capacity)
+{
+    return (static_cast<unsigned>(pid) * 2654435761u) & (capacity - 1);
+}
+
+/**
+ * Close a cached fd
+ */
+static void close_cached(int * fd)
+{
+    if(*fd >= 0) {
+        close(*fd);
+        fds_open--;
+    }
+    *fd = -1;
+}
+
+/**
+ * Read a /proc/<pid> file, reusing the fd from the last sample when we have
+ * one. A stale fd (the process has gone) fails with ESRCH, in which case the
+ * file is opened again in case the pid has been reused.
+ *
+ * @param[in,out] fd The cached fd, -1 if none
+ * @param[in] dirfd The fd of /proc
+ * @param[in] pid_str The pid as a string
+ * @param[in] file The file in /proc/<pid>
+ * @param[out] buf The buffer to read into
+ * @param[in] maxlen The size of buf
+ *
+ * @return The number of bytes read or -1
+ */
+static ssize_t read_cached(int * fd, int dirfd, const char * pid_str,
+        const char * file, char * buf, size_t maxlen)
+{
+    ssize_t length = -1;
+    if(*fd >= 0) {
+        length = pread(*fd, buf, maxlen-1, 0);
+        if(length < 0) {
+            close_cached(fd);
+        }
+    }
+    if(length < 0) {
+        char pathname[64];
+        snprintf(pathname, sizeof(pathname), "%s/%s", pid_str, file);
+        const int f = openat(dirfd, pathname, O_RDONLY | O_CLOEXEC);
+        if(f < 0) {
+            return errno == EACCES ? -2 : -1;
+        }
+        length = read(f, buf, maxlen-1);
+        if((length >= 0) && (fds_open < fd_budget)) {
+            *fd = f;
+            fds_open++;
+        }
+        else {
+            close(f);
+        }
+    }
+    if(length >= 0) {
+        buf[length] = '\0';
+    }
+    return length;
+}
+
+/**
+ * The ProcEnergy constructor
+ *
+ * @param[in] proc_dir Where proc is mounted
+ */
+ProcEnergy::ProcEnergy(const char * proc_dir)
+{
+    memset(this, 0, sizeof(*this));
+    m_proc_dir = proc_dir;
+}
+
+/**
+ * The ProcEnergy destructor
+ */
+ProcEnergy::~ProcEnergy()
+{
+    for(unsigned i = 0; i < m_capacity; i++) {
+        if(m_slots[i].pid) {
+            close_cached(&m_slots[i].stat_fd);
+            close_cached(&m_slots[i].io_fd);
+        }
+    }
+    free(m_slots);
+}
+
+/**
+ * Find the slot for pid, claiming a free one if it is not there
+ *
+ * @param[in] pid The process id
+ *
+ * @return The slot or NULL if out of memory
+ */
+ProcSlot * ProcEnergy::lookup(pid_t pid)
+{
+    if(2 * (m_used + 1) > m_capacity) {
+        grow();
+        if(2 * (m_used + 1) > m_capacity) {
+            return NULL;
+        }
+    }
+    const unsigned mask = m_capacity - 1;
+    unsigned i = hash_pid(pid, m_capacity);
+    while(m_slots[i].pid) {
+        if(m_slots[i].pid == pid) {
+            return &m_slots[i];
+        }
+        i = (i + 1) & mask;
+    }
+    ProcSlot * slot = &m_slots[i];
+    slot->pid = pid;
+    slot->stat_fd = -1;
+    slot->io_fd = -1;
+    m_used++;
+    return slot;
+}
+
+/**
+ * Double the size of the slot table
+ */
+void ProcEnergy::grow()
+{
+    const unsigned capacity = m_capacity ? 2 * m_capacity : INITIAL_SLOTS;
+    ProcSlot * slots = static_cast<ProcSlot *>(calloc(capacity,
+                sizeof(ProcSlot)));
+    if(!slots) {
+        return;
+    }
+    for(unsigned i = 0; i < m_capacity; i++) {
+        if(m_slots[i].pid) {
+            unsigned j = hash_pid(m_slots[i].pid, capacity);
+            while(slots[j].pid) {
+                j = (j + 1) & (capacity - 1);
+            }
+            slots[j] = m_slots[i];
+        }
+    }
+    free(m_slots);
+    m_slots = slots;
+    m_capacity = capacity;
+}
+
+/**
+ * Free a slot, shifting back any following entries so lookups never need
+ * tombstones
+ *
+ * @param[in] slot The slot to free
+ */
+void ProcEnergy::remove(ProcSlot * slot)
+{
+    const unsigned mask = m_capacity - 1;
+    close_cached(&slot->stat_fd);
+    close_cached(&slot->io_fd);
+
+    unsigned hole = slot - m_slots;
+    unsigned i = (hole + 1) & mask;
+    while(m_slots[i].pid) {
+        const unsigned home = hash_pid(m_slots[i].pid, m_capacity);
+        /* Can entry i legally live in the hole? */
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            m_slots[hole] = m_slots[i];
+            hole = i;
+        }
+        i = (i + 1) & mask;
+    }
+    memset(&m_slots[hole], 0, sizeof(ProcSlot));
+    m_used--;
+}
+
+/**
+ * Free the slots of processes that were not seen in the current sample
+ */
+void ProcEnergy::sweep()
+{
+    unsigned i = 0;
+    while(i < m_capacity) {
+        ProcSlot * slot = &m_slots[i];
+        if(slot->pid && (slot->generation != m_generation)) {
+            /* Re-examine i, remove() may have shifted an entry into it */
+            remove(slot);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+/**
+ * Read the CPU time and start time of a process
+ *
+ * @param[in,out] slot The process slot
+ * @param[in] dirfd The fd of /proc
+ * @param[in] pid_str The pid as a string
+ * @param[out] ticks User plus system time in clock ticks
+ * @param[out] start_time Start time since boot in clock ticks
+ *
+ * @return true if read OK
+ */
+bool ProcEnergy::read_stat(ProcSlot * slot, int dirfd, const char * pid_str,
+        unsigned long long * ticks, unsigned long long * start_time)
+{
+    char buf[512];
+    if(read_cached(&slot->stat_fd, dirfd, pid_str, "stat", buf,
+                sizeof(buf)) <= 0) {
+        return false;
+    }
+
+    /* The comm can contain anything, including ')', so use the last one */
+    const char * open = strchr(buf, '(');
+    const char * close = strrchr(buf, ')');
+    if(!open || !close || (close < open)) {
+        return false;
+    }
+    size_t len = close - open - 1;
+    if(len >= PROC_COMM_LEN) {
+        len = PROC_COMM_LEN - 1;
+    }
+    memcpy(slot->comm, open + 1, len);
+    slot->comm[len] = '\0';
+
+    /* Field 3 (state) follows the comm, we want 14, 15 and 22 */
+    const char * p = close + 2;
+    unsigned long long utime = 0, stime = 0;
+    for(int field = 3; field < 22; field++) {
+        p = strchr(p, ' ');
+        if(!p) {
+            return false;
+        }
+        p++;
+        if(field == 13) {
+            utime = strtoull(p, NULL, 10);
+        }
+        else if(field == 14) {
+            stime = strtoull(p, NULL, 10);
+        }
+    }
+    *start_time = strtoull(p, NULL, 10);
+    *ticks = utime + stime;
+    return true;
+}
+
+/**
+ * Read the block IO done by a process
+ *
+ * @param[in,out] slot The process slot
+ * @param[in] dirfd The fd of /proc
+ * @param[in] pid_str The pid as a string
+ * @param[out] bytes Bytes read from plus written to storage
+ *
+ * @return true if read OK
+ */
+bool ProcEnergy::read_io(ProcSlot * slot, int dirfd, const char * pid_str,
+        unsigned long long * bytes)
+{
+    char buf[512];
+    if(slot->io_fd == FD_DENIED) {
+        return false;
+    }
+    const ssize_t length = read_cached(&slot->io_fd, dirfd, pid_str, "io",
+            buf, sizeof(buf));
+    if(length == -2) {
+        slot->io_fd = FD_DENIED;
+    }
+    if(length <= 0) {
+        return false;
+    }
+    const char * rd = strstr(buf, "read_bytes: ");
+    const char * wr = strstr(buf, "\nwrite_bytes: ");
+    if(!rd || !wr) {
+        return false;
+    }
+    *bytes = strtoull(rd + 12, NULL, 10) + strtoull(wr + 14, NULL, 10);
+    return true;
+}
+
+/**
+ * Insert into a top-N table that is kept sorted, biggest first
+ *
+ * @param[in,out] top The table
+ * @param[in,out] num The number of entries in the table
+ * @param[in] entry The candidate entry
+ */
+static void insert_top(ProcEnergyTop * top, int * num, const ProcEnergyTop & entry)
+{
+    int i = *num;
+    if(i == PROC_ENERGY_TOP_N) {
+        if(entry.joules <= top[i-1].joules) {
+            return;
+        }
+        i--;
+    }
+    else {
+        (*num)++;
+    }
+    while((i > 0) && (top[i-1].joules < entry.joules)) {
+        top[i] = top[i-1];
+        i--;
+    }
+    top[i] = entry;
+}
+
+/**
+ * Rebuild the top-N table. Processes that have exited keep their place
+ * (decaying) until pushed out by busier ones.
+ *
+ * @param[in] decay The factor (Q16) to decay the exited processes by
+ */
+void ProcEnergy::update_top(unsigned decay)
+{
+    ProcEnergyTop top[PROC_ENERGY_TOP_N];
+    int num = 0;
+
+    for(int i = 0; i < m_num_top; i++) {
+        ProcEnergyTop entry = m_top[i];
+        const unsigned mask = m_capacity - 1;
+        unsigned j = hash_pid(entry.pid, m_capacity);
+        bool alive = false;
+        while(m_slots[j].pid) {
+            if(m_slots[j].pid == entry.pid) {
+                alive = m_slots[j].start_time == entry.start_time;
+                break;
+            }
+            j = (j + 1) & mask;
+        }
+        if(!alive) {
+            entry.joules = apply_decay(entry.joules, decay);
+            insert_top(top, &num, entry);
+        }
+    }
+
+    for(unsigned i = 0; i < m_capacity; i++) {
+        const ProcSlot * slot = &m_slots[i];
+        if(slot->pid && (slot->joules > MicroJoules(0))) {
+            if((num == PROC_ENERGY_TOP_N) && (slot->joules <= top[num-1].joules)) {
+                continue;
+            }
+            ProcEnergyTop entry;
+            entry.pid = slot->pid;
+            entry.start_time = slot->start_time;
+            entry.joules = slot->joules;
+            memcpy(entry.comm, slot->comm, sizeof(entry.comm));
+            insert_top(top, &num, entry);
+        }
+    }
+    memcpy(m_top, top, sizeof(top));
+    m_num_top = num;
+}
+
+/**
+ * Take a sample of all processes and share out the energy used since the
+ * last sample according to how busy each process was.
+ *
+ * @param[in] discharge_rate The battery discharge rate, 0 if not
+ *      discharging
+ */
+void ProcEnergy::sample(MicroWatts discharge_rate)
+{
+    const int64_t now = now_msecs();
+
+    /* Cache fds from the second sample on, a oneshot checker only takes
+     * the one and has no use for them */
+    if(m_generation == 1) {
+        init_fd_budget();
+    }
+
+    DIR * dir = opendir(m_proc_dir);
+    if(!dir) {
+        return;
+    }
+    const int dir_fd = dirfd(dir);
+
+    m_generation++;
+    unsigned long long total_weight = 0;
+    struct dirent * entry;
+    while((entry = readdir(dir))) {
+        const char * pid_str = entry->d_name;
+        if((pid_str[0] < '1') || (pid_str[0] > '9')) {
+            continue;
+        }
+        const pid_t pid = strtol(pid_str, NULL, 10);
+        ProcSlot * slot = lookup(pid);
+        if(!slot) {
+            break;
+        }
+
+        unsigned long long ticks, start_time;
+        if(!read_stat(slot, dir_fd, pid_str, &ticks, &start_time)) {
+            /* Gone, let sweep() free the slot */
+            continue;
+        }
+        slot->generation = m_generation;
+        slot->weight = 0;
+
+        /* Counts going back means a new boot, since the last sample */
+        if((start_time != slot->start_time) || (ticks < slot->cpu_ticks)) {
+            /* A new process, possibly reusing an old pid */
+            close_cached(&slot->io_fd);
+            slot->start_time = start_time;
+            slot->cpu_ticks = ticks;
+            slot->io_bytes = 0;
+            slot->joules = MicroJoules(0);
+            read_io(slot, dir_fd, pid_str, &slot->io_bytes);
+            continue;
+        }
+
+        /* No CPU time means no IO issued either, so skip reading it */
+        if(ticks == slot->cpu_ticks) {
+            continue;
+        }
+        unsigned long long io_bytes = slot->io_bytes;
+        read_io(slot, dir_fd, pid_str, &io_bytes);
+        if(io_bytes < slot->io_bytes) {
+            io_bytes = slot->io_bytes;
+        }
+
+        slot->weight = (ticks - slot->cpu_ticks) * TICK_WEIGHT
+            + (io_bytes - slot->io_bytes) / 1024;
+        slot->cpu_ticks = ticks;
+        slot->io_bytes = io_bytes;
+        total_weight += slot->weight;
+    }
+    closedir(dir);
+    sweep();
+
+    const int64_t elapsed = now - m_last_sample;
+    m_last_sample = now;
+    if(!m_primed || (elapsed < 0)) {
+        m_primed = true;
+        return;
+    }
+
+    const unsigned decay = calc_decay(elapsed);
+    MicroJoules energy(0);
+    if((discharge_rate > MicroWatts(0)) && (total_weight > 0)) {
+        energy = energy_over(discharge_rate, elapsed);
+    }
+    for(unsigned i = 0; i < m_capacity; i++) {
+        ProcSlot * slot = &m_slots[i];
+        if(slot->pid) {
+            slot->joules = apply_decay(slot->joules, decay);
+            if(slot->weight) {
+                slot->joules += MicroJoules(muldiv(energy.micro(),
+                            slot->weight, total_weight));
+            }
+        }
+    }
+    update_top(decay);
+}
+
+/**
+ * print info
+ */
+void ProcEnergy::print_self() const
+{
+    for(int i = 0; i < m_num_top; i++) {
+        out_printf("%7i %-15s %10.1f J\n", m_top[i].pid, m_top[i].comm,
+                m_top[i].joules.to_float());
+    }
+}
+
+/**
+ * Format the top-N table, a "pid\tcomm\tjoules" line each
+ *
+ * @param[out] buf The buffer
+ * @param[in] maxlen The size of buf
+ *
+ * @return The length, which is all that fits
+ */
+int ProcEnergy::format_top(char * buf, size_t maxlen) const
+{
+    size_t length = 0;
+    buf[0] = '\0';
+    for(int i = 0; i < m_num_top; i++) {
+        const int n = snprintf(buf + length, maxlen - length, "%i\t%s\t%.1f\n",
+                m_top[i].pid, m_top[i].comm, m_top[i].joules.to_float());
+        if((n < 0) || (length + n >= maxlen)) {
+            buf[length] = '\0';
+            break;
+        }
+        length += n;
+    }
+    return length;
+}
+
+/**
+ * Write the top-N table, so others can see who is draining the battery
+ *
+ * @param[in] path The file to write
+ */
+void ProcEnergy::save_top(const char * path) const
+{
+    char buf[PROC_ENERGY_TOP_N * 64];
+    write_file(path, buf, format_top(buf, sizeof(buf)));
+}
+
+/**
+ * Load the last sample of every process and the top-N table, as saved by
+ * the last run. Ignored if there has been a reboot since, as the pids and
+ * their start times begin again.
+ *
+ * @param[in] path The state file
+ */
+void ProcEnergy::load(const char * path)
+{
+    char * buf = static_cast<char *>(malloc(MAX_STATE_SIZE));
+    if(!buf) {
+        return;
+    }
+    if(read_file(path, buf, MAX_STATE_SIZE) > 0) {
+        /* Parsed by hand rather than with fscanf(), no stdio */
+        char * pos = buf;
+        const long version = strtol(pos, &pos, 10);
+        const int64_t last_sample = strtoll(pos, &pos, 10);
+        pos += strspn(pos, " ");
+        const size_t boot_id_len = strcspn(pos, " \n");
+        char boot_id[BOOT_ID_LEN];
+        read_boot_id(m_proc_dir, boot_id);
+        if((version == STATE_VERSION) && (last_sample > 0)
+                && (last_sample <= now_msecs())
+                && (boot_id_len == strlen(boot_id))
+                && !strncmp(pos, boot_id, boot_id_len)) {
+            pos += boot_id_len;
+            m_last_sample = last_sample;
+            m_primed = true;
+            pos += strspn(pos, "\n");
+            while(*pos) {
+                const char kind = *pos++;
+                const pid_t pid = strtol(pos, &pos, 10);
+                const unsigned long long start_time = strtoull(pos, &pos, 10);
+                if(kind == 'T') {
+                    if(m_num_top < PROC_ENERGY_TOP_N) {
+                        ProcEnergyTop & top = m_top[m_num_top++];
+                        top.pid = pid;
+                        top.start_time = start_time;
+                        top.joules = MicroJoules(strtoll(pos, &pos, 10));
+                        parse_comm(&pos, top.comm);
+                    }
+                }
+                else if(kind == 'P') {
+                    ProcSlot * slot = pid > 0 ? lookup(pid) : NULL;
+                    if(!slot) {
+                        break;
+                    }
+                    slot->start_time = start_time;
+                    slot->cpu_ticks = strtoull(pos, &pos, 10);
+                    slot->io_bytes = strtoull(pos, &pos, 10);
+                    slot->joules = MicroJoules(strtoll(pos, &pos, 10));
+                    parse_comm(&pos, slot->comm);
+                }
+                pos += strcspn(pos, "\n");
+                pos += strspn(pos, "\n");
+            }
+        }
+    }
+    free(buf);
+}
+
+/**
+ * Save the last sample of every process and the top-N table, for the next
+ * run to carry on from
+ *
+ * @param[in] path The state file
+ */
+void ProcEnergy::save(const char * path) const
+{
+    const size_t maxlen = (m_used + PROC_ENERGY_TOP_N + 1) * MAX_STATE_LINE;
+    char * buf = static_cast<char *>(malloc(maxlen));
+    if(!buf) {
+        return;
+    }
+    char comm[PROC_COMM_LEN];
+    char boot_id[BOOT_ID_LEN];
+    read_boot_id(m_proc_dir, boot_id);
+    size_t length = snprintf(buf, maxlen, "%i %" PRId64 " %s\n", STATE_VERSION,
+            m_last_sample, boot_id);
+    for(int i = 0; i < m_num_top; i++) {
+        clean_comm(comm, m_top[i].comm);
+        length += snprintf(buf + length, maxlen - length, "T %i %llu %" PRId64
+                " %s\n", m_top[i].pid, m_top[i].start_time,
+                m_top[i].joules.micro(), comm);
+    }
+    for(unsigned i = 0; i < m_capacity; i++) {
+        const ProcSlot * slot = &m_slots[i];
+        if(slot->pid) {
+            clean_comm(comm, slot->comm);
+            length += snprintf(buf + length, maxlen - length, "P %i %llu %llu"
+                    " %llu %" PRId64 " %s\n", slot->pid, slot->start_time,
+                    slot->cpu_ticks, slot->io_bytes, slot->joules.micro(), comm);
+        }
+    }
+    if(length < maxlen) {
+        write_file(path, buf, length);
+    }
+    free(buf);
+}
@@ -0,0 +1,92 @@
+#ifndef _PROC_ENERGY_H_
+#define _PROC_ENERGY_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "root_prefix.h"
+#include "units.h"
+
+#define PROC_PREFIX ROOT_PREFIX "/proc"
+#define PROC_ENERGY_STATE ROOT_PREFIX "/var/cache/batt_checker/proc_energy"
+
+#define PROC_ENERGY_TOP_N 10
+#define PROC_COMM_LEN 16
+
+/**
+ * An entry in the top-N energy table
+ */
+struct ProcEnergyTop
+{
+    pid_t pid;
+    unsigned long long start_time;
+    MicroJoules joules;
+    char comm[PROC_COMM_LEN];
+};
+
+/**
+ * What we remember about a process between samples
+ */
+struct ProcSlot
+{
+    pid_t pid;                      /* 0 means slot is free */
+    int stat_fd;
+    int io_fd;
+    unsigned generation;
+    unsigned long long start_time;
+    unsigned long long cpu_ticks;
+    unsigned long long io_bytes;
+    unsigned long long weight;      /* activity in the current sample */
+    MicroJoules joules;
+    char comm[PROC_COMM_LEN];
+};
+
+/**
+ * Apportion the measured battery discharge rate across the running
+ * processes, based on their CPU time and block IO since the last sample.
+ * The last sample of every process is kept in a state file, so a oneshot
+ * checker attributes the discharge since the last run. From the second
+ * sample on (so only in the reminder loop) the /proc files of each process
+ * are kept open between samples rather than opened again.
+ */
+class ProcEnergy
+{
+private:
+    const char * m_proc_dir;
+    ProcSlot * m_slots;
+    unsigned m_capacity;            /* Always a power of 2 */
+    unsigned m_used;
+    unsigned m_generation;
+    bool m_primed;
+    int64_t m_last_sample;          /* msecs */
+    ProcEnergyTop m_top[PROC_ENERGY_TOP_N];
+    int m_num_top;
+
+    ProcSlot * lookup(pid_t pid);
+    void grow();
+    void remove(ProcSlot * slot);
+    void sweep();
+    bool read_stat(ProcSlot * slot, int dirfd, const char * pid_str,
+            unsigned long long * ticks, unsigned long long * start_time);
+    bool read_io(ProcSlot * slot, int dirfd, const char * pid_str,
+            unsigned long long * bytes);
+    void update_top(unsigned decay);
+public:
+    ProcEnergy(const char * proc_dir = PROC_PREFIX);
+    ~ProcEnergy();
+    void load(const char * path);
+    void save(const char * path) const;
+    void sample(MicroWatts discharge_rate);
+    void print_self() const;
+    int format_top(char * buf, size_t maxlen) const;
+    void save_top(const char * path) const;
+};
+
+#endif
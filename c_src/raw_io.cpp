@@ -0,0 +1,138 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "raw_io.h"
+
+/* Enough for all the output of a check, so it is one write */
+#define OUT_SIZE 4096
+
+static char out_buf[OUT_SIZE];
+static size_t out_length = 0;
+
+/**
+ * Write all of a buffer, retrying short writes
+ */
+bool write_all(int fd, const char * data, size_t length)
+{
+    while(length > 0) {
+        const ssize_t done = write(fd, data, length);
+        if(done <= 0) {
+            return false;
+        }
+        data += done;
+        length -= done;
+    }
+    return true;
+}
+
+/**
+ * Write out what has been buffered for stdout
+ */
+void out_flush()
+{
+    write_all(1, out_buf, out_length);
+    out_length = 0;
+}
+
+/**
+ * printf() to stdout, buffered until out_flush() or the buffer fills
+ */
+void out_printf(const char * fmt, ...)
+{
+    va_list args;
+    for(int tries = 0; tries < 2; tries++) {
+        va_start(args, fmt);
+        const int length = vsnprintf(out_buf + out_length,
+                OUT_SIZE - out_length, fmt, args);
+        va_end(args);
+        if(length < 0) {
+            return;
+        }
+        if(out_length + length < OUT_SIZE) {
+            out_length += length;
+            return;
+        }
+        /* Didn't fit, make room and try again, truncating if need be */
+        out_flush();
+    }
+    out_length = OUT_SIZE - 1;
+}
+
+/**
+ * printf() to stderr, unbuffered (after anything buffered for stdout)
+ */
+void err_printf(const char * fmt, ...)
+{
+    out_flush();
+    char buf[512];
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if(length > 0) {
+        if(length >= static_cast<int>(sizeof(buf))) {
+            length = sizeof(buf) - 1;
+        }
+        write_all(2, buf, length);
+    }
+}
+
+/**
+ * Read a small file
+ *
+ * @param[in] path The file
+ * @param[out] buf The buffer for the contents, which are '\0' terminated
+ * @param[in] maxlen The size of buf
+ *
+ * @return The number of bytes read, or -1 if the file can't be read
+ */
+ssize_t read_file(const char * path, char * buf, size_t maxlen)
+{
+    const int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return -1;
+    }
+    size_t length = 0;
+    ssize_t got;
+    while((length < maxlen - 1)
+            && ((got = read(fd, buf + length, maxlen - 1 - length)) > 0)) {
+        length += got;
+    }
+    close(fd);
+    buf[length] = '\0';
+    return length;
+}
+
+/**
+ * Replace a small file. Written to a temporary file first so a flat battery
+ * part way through can't leave it corrupt.
+ *
+ * @param[in] path The file
+ * @param[in] data The new contents
+ * @param[in] length The size of the contents
+ *
+ * @return true if written
+ */
+bool write_file(const char * path, const char * data, size_t length)
+{
+    char tmp_path[1024];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.new", path);
+    const int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return false;
+    }
+    const bool ok = write_all(fd, data, length);
+    if((close(fd) != 0) || !ok) {
+        unlink(tmp_path);
+        return false;
+    }
+    return rename(tmp_path, path) == 0;
+}
@@ -0,0 +1,28 @@
+#ifndef _RAW_IO_H_
+#define _RAW_IO_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Output and small file access straight on top of the system calls, so
+ * the checker doesn't need stdio (its buffers, isatty checks and locking)
+ * on every run.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+void out_printf(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+void err_printf(const char * fmt, ...) __attribute__((format(printf, 1, 2)));
+void out_flush();
+
+bool write_all(int fd, const char * data, size_t length);
+ssize_t read_file(const char * path, char * buf, size_t maxlen);
+bool write_file(const char * path, const char * data, size_t length);
+
+#endif
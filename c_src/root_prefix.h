@@ -0,0 +1,16 @@
+#ifndef _ROOT_PREFIX_H_
+#define _ROOT_PREFIX_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/* Put in front of every path the checker reads or writes, so a build can
+ * be pointed at a tree of its own rather than the host's /sys and /var */
+#ifndef ROOT_PREFIX
+#define ROOT_PREFIX ""
+#endif
+
+#endif
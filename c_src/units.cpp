@@ -0,0 +1,41 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <stdlib.h>
+
+#include "units.h"
+
+/**
+ * Convert a decimal (a string) to micro-units, without going via float.
+ * Digits beyond the 6th decimal place are ignored.
+ *
+ * @param[in] value as a string, e.g. "12.5"
+ * @param[out] end If not NULL, set to the first character not used
+ *
+ * @return value * 1000000
+ */
+int64_t parse_micro(const char * value, char ** end)
+{
+    char * pos;
+    int64_t result = strtoll(value, &pos, 10) * 1000000;
+    if(*pos == '.') {
+        const char * sign = value;
+        while((*sign == ' ') || (*sign == '\t')) {
+            sign++;
+        }
+        const bool negative = (*sign == '-');
+        int64_t scale = 100000;
+        for(pos++; (*pos >= '0') && (*pos <= '9'); pos++) {
+            const int64_t digit = (*pos - '0') * scale;
+            result += negative ? -digit : digit;
+            scale /= 10;
+        }
+    }
+    if(end) {
+        *end = pos;
+    }
+    return result;
+}
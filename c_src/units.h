@@ -0,0 +1,119 @@
+#ifndef _UNITS_H_
+#define _UNITS_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Fixed point micro-units. Sysfs reports in micro-units anyway, so keeping
+ * them as 64 bit integers loses nothing and avoids floating point (which is
+ * soft-float on some targets) until the values are printed. Each unit is its
+ * own type so mixing them up fails to compile.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+template<class Unit>
+class Micro
+{
+private:
+    int64_t m_value;
+public:
+    /* Trivial so objects holding units can still be memset(), use Micro()
+     * or Micro(0) to get zero */
+    Micro() = default;
+    constexpr explicit Micro(int64_t value) : m_value(value) {};
+    constexpr int64_t micro() const {return m_value;};
+
+    /* Only for output */
+    float to_float() const {return m_value / 1000000.0f;};
+
+    constexpr Micro operator+(Micro other) const {return Micro(m_value + other.m_value);};
+    constexpr Micro operator-(Micro other) const {return Micro(m_value - other.m_value);};
+    constexpr Micro operator*(int64_t scale) const {return Micro(m_value * scale);};
+    constexpr Micro operator/(int64_t scale) const {return Micro(m_value / scale);};
+    Micro & operator+=(Micro other) {m_value += other.m_value; return *this;};
+    Micro & operator-=(Micro other) {m_value -= other.m_value; return *this;};
+
+    constexpr bool operator==(Micro other) const {return m_value == other.m_value;};
+    constexpr bool operator!=(Micro other) const {return m_value != other.m_value;};
+    constexpr bool operator<(Micro other) const {return m_value < other.m_value;};
+    constexpr bool operator<=(Micro other) const {return m_value <= other.m_value;};
+    constexpr bool operator>(Micro other) const {return m_value > other.m_value;};
+    constexpr bool operator>=(Micro other) const {return m_value >= other.m_value;};
+};
+
+struct JouleUnit;
+struct WattUnit;
+struct VoltUnit;
+struct AmpUnit;
+
+typedef Micro<JouleUnit> MicroJoules;
+typedef Micro<WattUnit> MicroWatts;
+typedef Micro<VoltUnit> MicroVolts;
+typedef Micro<AmpUnit> MicroAmps;
+
+/**
+ * Convert uWh (as in energy_*) to uJ
+ */
+constexpr MicroJoules uwatthr2ujoules(int64_t value)
+{
+    return MicroJoules(value * 60 * 60);
+}
+
+/**
+ * Convert uAh (as in charge_*) to uJ, at the given voltage.
+ * uAh * uV is pWh, * 3600 / 1000000 is uJ, i.e. * 9 / 2500.
+ */
+constexpr MicroJoules uamphr2ujoules(int64_t value, MicroVolts volts)
+{
+    return MicroJoules(value * volts.micro() * 9 / 2500);
+}
+
+/**
+ * Power from current and voltage
+ */
+constexpr MicroWatts operator*(MicroAmps amps, MicroVolts volts)
+{
+    return MicroWatts(amps.micro() * volts.micro() / 1000000);
+}
+
+/**
+ * Energy used at a rate for a time
+ *
+ * @param[in] rate The rate
+ * @param[in] msecs The time in milli-seconds
+ */
+constexpr MicroJoules energy_over(MicroWatts rate, int64_t msecs)
+{
+    return MicroJoules(rate.micro() * msecs / 1000);
+}
+
+/**
+ * Time (in seconds) to use energy at a rate, rounded to nearest
+ */
+constexpr int64_t secs_to_use(MicroJoules energy, MicroWatts rate)
+{
+    return (energy.micro() + rate.micro() / 2) / rate.micro();
+}
+
+/**
+ * Calculate value * num / den without overflow, for num <= den. Halves
+ * num and den until their product with anything under 2^31 fits.
+ */
+constexpr int64_t muldiv(int64_t value, uint64_t num, uint64_t den)
+{
+    return (den >= (1ull << 31))
+        ? muldiv(value, num >> 1, den >> 1)
+        : (value / static_cast<int64_t>(den)) * static_cast<int64_t>(num)
+            + (value % static_cast<int64_t>(den)) * static_cast<int64_t>(num)
+                / static_cast<int64_t>(den);
+}
+
+int64_t parse_micro(const char * value, char ** end);
+
+#endif
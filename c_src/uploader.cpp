@@ -0,0 +1,247 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "battery_info.h"
+#include "history.h"
+#include "raw_io.h"
+#include "uploader.h"
+
+#define MACHINE_ID ROOT_PREFIX "/etc/machine-id"
+
+/**
+ * Make a name valid for the collector, anything else becomes '_'
+ *
+ * @param[in,out] name The name
+ * @param[in] model true for a model, which can have spaces
+ */
+static void clean_name(char * name, bool model)
+{
+    name[FLEET_MAX_NAME] = '\0';
+    for(char * c = name; *c; c++) {
+        const bool ok = model ? ((*c >= ' ') && (*c <= '~'))
+            : (((*c >= 'a') && (*c <= 'z')) || ((*c >= 'A') && (*c <= 'Z'))
+                || ((*c >= '0') && (*c <= '9')) || (*c == '.') || (*c == '_')
+                || (*c == '-'));
+        if(!ok || (!model && (c == name) && (*c == '.'))) {
+            *c = '_';
+        }
+    }
+}
+
+/**
+ * Where the size the outbox has to reach before the next try is kept, after
+ * a failed upload
+ */
+static void retry_path(const char * outbox, char * path, size_t maxlen)
+{
+    snprintf(path, maxlen, "%s.retry", outbox);
+}
+
+/**
+ * Set the size for the next try, 0 for the default. Not written through a
+ * temporary file, a corrupt one only means an early retry.
+ */
+static void set_retry(const char * outbox, size_t next)
+{
+    char path[1024];
+    char buf[32];
+    retry_path(outbox, path, sizeof(path));
+    const int length = next ? snprintf(buf, sizeof(buf), "%zu\n", next) : 0;
+    const int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd >= 0) {
+        write_all(fd, buf, length);
+        close(fd);
+    }
+}
+
+/**
+ * Send the segment built so far
+ */
+static bool send_segment(const char * collector, HistoryWriter & writer,
+        FleetUpload * upload)
+{
+    upload->segment_length = writer.finish(&upload->segment);
+    return (upload->segment_length > 0)
+        && fleet_send(collector, *upload, UPLOAD_TIMEOUT);
+}
+
+/**
+ * The Uploader constructor
+ *
+ * @param[in] collector The batt_collector's address (see fleet.h)
+ */
+Uploader::Uploader(const char * collector)
+{
+    memset(this, 0, sizeof(*this));
+    m_collector = collector;
+}
+
+/**
+ * Get the name of this host for the collector, the machine id, or the host
+ * name if there isn't one
+ */
+const char * Uploader::get_host()
+{
+    if(!m_host[0]) {
+        char buf[FLEET_MAX_NAME + 2];
+        if(read_file(MACHINE_ID, buf, sizeof(buf)) <= 0) {
+            gethostname(buf, sizeof(buf));
+            buf[sizeof(buf) - 1] = '\0';
+        }
+        buf[strcspn(buf, "\n")] = '\0';
+        clean_name(buf, false);
+        strcpy(m_host, buf[0] ? buf : "unknown");
+    }
+    return m_host;
+}
+
+/**
+ * Upload the outbox, as many segments as it takes
+ *
+ * @param[in] pending The battery
+ * @param[in] fd The outbox
+ * @param[in] size The size of the outbox
+ *
+ * @return true if it was all stored
+ */
+bool Uploader::upload(const Pending & pending, int fd, size_t size)
+{
+    char * lines = static_cast<char *>(malloc(size + 1));
+    if(!lines || (pread(fd, lines, size, 0) != static_cast<ssize_t>(size))) {
+        free(lines);
+        return false;
+    }
+    lines[size] = '\0';
+
+    FleetUpload upload;
+    memset(&upload, 0, sizeof(upload));
+    strcpy(upload.host, get_host());
+    strcpy(upload.battery, pending.name);
+    clean_name(upload.battery, false);
+    strcpy(upload.model, pending.model);
+
+    bool ok = true;
+    unsigned samples = 0;
+    HistoryWriter writer;
+    char * line = lines;
+    while(ok && *line) {
+        char * end = strchr(line, '\n');
+        end = end ? end + 1 : line + strlen(line);
+        HistorySample sample;
+        const bool valid = history_parse_line(line, &sample);
+        line = end;
+        if(!valid) {
+            continue;
+        }
+        /* A new segment when one can't hold the next sample */
+        if(!writer.append(sample)) {
+            samples += writer.count();
+            ok = send_segment(m_collector, writer, &upload);
+            writer.reset();
+            ok = ok && writer.append(sample);
+        }
+    }
+    if(ok && writer.count()) {
+        samples += writer.count();
+        ok = send_segment(m_collector, writer, &upload);
+    }
+    free(lines);
+    if(ok) {
+        out_printf("Uploaded %u samples to %s\n", samples, m_collector);
+    }
+    return ok;
+}
+
+/**
+ * Queue a sample, and note the battery for flush() once there is a batch
+ *
+ * @param[in] info The battery
+ * @param[in] name The battery's name
+ * @param[in] sample The sample, as written to the history
+ */
+void Uploader::queue(const BatteryInfo & info, const char * name,
+        const HistorySample & sample)
+{
+    char outbox[512];
+    snprintf(outbox, sizeof(outbox), "%s%s", OUTBOX_PREFIX, name);
+    const int fd = open(outbox, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    char line[256];
+    const int length = history_format_line(sample, line, sizeof(line));
+    struct stat st;
+    const bool batch = write_all(fd, line, length) && (fstat(fd, &st) == 0)
+        && (st.st_size >= UPLOAD_BATCH_SIZE);
+    close(fd);
+
+    if(batch && (m_num_pending < UPLOADER_MAX_PENDING)
+            && (strlen(name) < sizeof(m_pending[0].name))) {
+        Pending & pending = m_pending[m_num_pending++];
+        strcpy(pending.name, name);
+        info.get_model(pending.model, sizeof(pending.model));
+        clean_name(pending.model, true);
+    }
+}
+
+/**
+ * Upload a battery's outbox, if it is time to try again
+ */
+void Uploader::flush_outbox(const Pending & pending)
+{
+    char outbox[512];
+    snprintf(outbox, sizeof(outbox), "%s%s", OUTBOX_PREFIX, pending.name);
+    const int fd = open(outbox, O_RDWR | O_CLOEXEC);
+    if(fd < 0) {
+        return;
+    }
+    flock(fd, LOCK_EX);
+    char path[1024];
+    char buf[32];
+    size_t next = UPLOAD_BATCH_SIZE;
+    retry_path(outbox, path, sizeof(path));
+    if(read_file(path, buf, sizeof(buf)) > 0) {
+        next = strtoul(buf, NULL, 10);
+    }
+    struct stat st;
+    const size_t size = fstat(fd, &st) == 0 ? st.st_size : 0;
+    if(size >= next) {
+        if(upload(pending, fd, size)) {
+            ftruncate(fd, 0);
+            set_retry(outbox, 0);
+        }
+        else if(size > OUTBOX_MAX_SIZE) {
+            out_printf("Failed to upload to %s, dropped the queue\n", m_collector);
+            ftruncate(fd, 0);
+            set_retry(outbox, 0);
+        }
+        else {
+            out_printf("Failed to upload to %s\n", m_collector);
+            set_retry(outbox, size + UPLOAD_BATCH_SIZE);
+        }
+    }
+    close(fd);
+}
+
+/**
+ * Upload the outboxes that queue() found have a batch
+ */
+void Uploader::flush()
+{
+    for(int i = 0; i < m_num_pending; i++) {
+        flush_outbox(m_pending[i]);
+    }
+    m_num_pending = 0;
+}
@@ -0,0 +1,71 @@
+#ifndef _UPLOADER_H_
+#define _UPLOADER_H_
+
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "fleet.h"
+#include "root_prefix.h"
+
+#define OUTBOX_PREFIX ROOT_PREFIX "/var/cache/batt_checker/outbox_"
+
+/* Queued data.log lines that trigger an upload, about a day of samples at
+ * the default 15 minute period */
+#define UPLOAD_BATCH_SIZE (4 * 1024)
+
+/* Most kept queued while the collector can't be reached, beyond that the
+ * queue is dropped (the samples are still in the local history) */
+#define OUTBOX_MAX_SIZE (256 * 1024)
+
+/* Secs to wait on the collector at each step */
+#define UPLOAD_TIMEOUT 10
+
+/* Batteries with a batch to upload kept track of in a run, any more wait
+ * for the next run */
+#define UPLOADER_MAX_PENDING 4
+
+class BatteryInfo;
+struct HistorySample;
+
+/**
+ * Queues each battery's samples in a local outbox and uploads them to a
+ * batt_collector in large batches, so the radio (and the collector's disk)
+ * is woken about once a day rather than every sample. After a failed upload
+ * it waits for another batch to queue before trying again. Queueing only
+ * appends to the outbox, the uploads wait for flush(), so a slow collector
+ * can't hold up the rest of a run.
+ */
+class Uploader
+{
+private:
+    /**
+     * A battery whose outbox has a batch to upload
+     */
+    struct Pending
+    {
+        char name[FLEET_MAX_NAME + 1];
+        char model[FLEET_MAX_NAME + 1];
+    };
+
+    const char * m_collector;
+    char m_host[FLEET_MAX_NAME + 1];
+    Pending m_pending[UPLOADER_MAX_PENDING];
+    int m_num_pending;
+
+    const char * get_host();
+    bool upload(const Pending & pending, int fd, size_t size);
+    void flush_outbox(const Pending & pending);
+public:
+    Uploader(const char * collector);
+    void queue(const BatteryInfo & info, const char * name,
+            const HistorySample & sample);
+    void flush();
+};
+
+#endif
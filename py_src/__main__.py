@@ -108,17 +108,27 @@ def find_displays():
 #        with open(CACHE_FILE, "w") as out_fp:
 #            write_record(out_fp, ip_addr)
 
-def alert_terminals(terminals, left):
+def alert_text(left, message):
+    """What to tell the user"""
+    if message:
+        return "Battery alert: {}".format(message)
+    return "Battery getting low {} mins left".format(left)
+
+
+def alert_terminals(terminals, left, message):
     """Send an alert message to the terminals"""
     for term in terminals:
         with open(term, "w") as out_fp:
-            out_fp.write("Battery is low ({} mins to go)\n".format(left))
+            if message:
+                out_fp.write("{}\n".format(alert_text(left, message)))
+            else:
+                out_fp.write("Battery is low ({} mins to go)\n".format(left))
 
 
 class Alert(tkinter.Frame):
     """TK alert box"""
 
-    def __init__(self, master, left):
+    def __init__(self, master, left, message):
         tkinter.Frame.__init__(self, master)
         self.root = master
         self.root.geometry("+0-10")
@@ -132,9 +142,7 @@ class Alert(tkinter.Frame):
         self.OK["command"] = self.quit
         self.OK.pack({"side": "bottom"})
         self.LABEL = tkinter.Label(self)
-        self.LABEL["text"] = "Battery getting low {} mins left" .format(
-            left
-        )
+        self.LABEL["text"] = alert_text(left, message)
         self.LABEL["font"] = tkFont.Font(size="30")
         self.LABEL.pack({"side": "top"})
         self.OK.bind('<Visibility>', self.painted)
@@ -155,14 +163,14 @@ class Alert(tkinter.Frame):
         self.root.quit()
 
 
-def alert_display(left):
+def alert_display(left, message):
     """Send an alert message to X-server"""
     root = tkinter.Tk()
-    app = Alert(root, left)
+    app = Alert(root, left, message)
     app.mainloop()
 
 
-def alert_displays(displays, left):
+def alert_displays(displays, left, message):
     """Send alert messages"""
     for (display, auth) in displays:
         fst = os.stat(auth)
@@ -173,7 +181,7 @@ def alert_displays(displays, left):
             os.seteuid(uid)
             os.putenv("DISPLAY", display)
             os.putenv("XAUTHORITY", auth)
-            alert_display(left)
+            alert_display(left, message)
         finally:
             os.seteuid(saved_uid)
             os.setegid(saved_gid)
@@ -211,6 +219,8 @@ def run():
         help="Enable debug"
     )
     parser.add_argument('left', help="time left")
+    parser.add_argument('message', nargs='?', default=None,
+                        help="the alert rules that fired")
     args = parser.parse_args()
     log = logging.getLogger()
     if args.debug:
@@ -218,11 +228,11 @@ def run():
         log.setLevel(logging.DEBUG)
     left = int(args.left)
     terminals, displays = find_displays()
-    alert_terminals(terminals, left)
+    alert_terminals(terminals, left, args.message)
     # Avoid double focus grab :)
     if lock():
         try:
-            alert_displays(displays, left)
+            alert_displays(displays, left, args.message)
         finally:
             os.unlink(PID_FILE)
 
@@ -4,6 +4,17 @@
 # Licensed under the GPL License. See LICENSE file in the project root for full license information.  
 ##
 
+import subprocess
+
+try:
+    from . import battlib
+except ImportError:
+    import battlib
+
+WORST_RATE = "/var/cache/batt_checker/worst_discharge_rate"
+MEAN_RATE = "/var/cache/batt_checker/mean_discharge_rate"
+
+
 def analysis_charge(change):
 #    print(change)
     pass
@@ -19,28 +30,63 @@ def analysis_discharge(charge):
         print("Min charge=", min_charge)
 
 
+def write_rate(path, rate):
+    """Write a rate (in uW) as W, as batt_checker reads it"""
+    with open(path, "w") as fp:
+        fp.write("{:.6f}\n".format(rate / 1000000))
+
+
+def analyse():
+    """Work out the discharge rates over the whole history natively, with
+    the same code (and history) batt_checker uses"""
+    with battlib.History() as history:
+        rates = history.rates()
+        print(len(history), "samples")
+    if rates:
+        print("Discharge rate worst={:.3f} W mean={:.3f} W over {} hours".format(
+            rates.worst / 1000000, rates.mean / 1000000, rates.secs // 3600))
+        write_rate(WORST_RATE, rates.worst)
+        write_rate(MEAN_RATE, rates.mean)
+
+
+def history_lines():
+    """The whole history, sealed segments included, as data.log lines"""
+    try:
+        proc = subprocess.Popen(["batt_history"], stdout=subprocess.PIPE,
+                universal_newlines=True)
+    except FileNotFoundError:
+        with open("/var/cache/batt_checker/data.log") as fp:
+            yield from fp
+        return
+    yield from proc.stdout
+    proc.wait()
+
+
 def parse():
     prev_time = None
     prev_cap = None
-    with open("/var/cache/batt_checker/data.log") as fp:
-        for line in fp:
-            tokens = line.split()
-            if not (tokens[0].isdigit() or tokens[1].isdigit()):
-                continue
-            real_time, up_time = int(tokens[0]), int(tokens[1])
-            cap = float(tokens[3])
-            if prev_time and (up_time > prev_time):
-                # Time in unit of seconds, max error is +/-0.5
-                period = (up_time - prev_time)
-                min_period = period - 1
-                max_period = period + 1
-                if min_period > 60:
-                    change = (cap - prev_cap)/period
-                    if change < 0:
+    for line in history_lines():
+        tokens = line.split()
+        if not (tokens[0].isdigit() or tokens[1].isdigit()):
+            continue
+        real_time, up_time = int(tokens[0]), int(tokens[1])
+        cap = float(tokens[3])
+        if prev_time and (up_time > prev_time):
+            # Time in unit of seconds, max error is +/-0.5
+            period = (up_time - prev_time)
+            min_period = period - 1
+            max_period = period + 1
+            if min_period > 60:
+                change = (cap - prev_cap)/period
+                if change < 0:
 #                        print("Change", change, "Period", period)
-                        analysis_discharge(change)
-                    else:
-                        analysis_charge(change)
-            prev_time, prev_cap = up_time, cap
+                    analysis_discharge(change)
+                else:
+                    analysis_charge(change)
+        prev_time, prev_cap = up_time, cap
 
-parse()
+try:
+    analyse()
+except OSError:
+    # No library, fall back to the text
+    parse()
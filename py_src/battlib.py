@@ -0,0 +1,202 @@
+##
+# Copyright (c) 2014 Peter Leese
+#
+# Licensed under the GPL License. See LICENSE file in the project root for full license information.
+##
+
+"""ctypes binding of libbattchecker.so, the C++ code batt_checker uses.
+
+History comes back as memoryviews straight over the library's columns, so
+there are no per-row Python objects and the columns can be handed to e.g.
+array or numpy.frombuffer() without a copy. The columns stay mapped until
+the History is closed and the last view of them (or anything made from
+one) is released.
+"""
+
+import ctypes
+import os
+import platform
+
+ABI_VERSION = 1
+
+LIB_NAMES = ("libbattchecker.so.1", "libbattchecker.so")
+
+REAL_TIME, UP_TIME, STATUS, CAPACITY, VOLTS = range(5)
+
+CHARGING, DISCHARGING, IDLE = range(3)
+
+
+class Battery(ctypes.Structure):
+    """struct bc_battery"""
+    _fields_ = [
+        ("present", ctypes.c_int32),
+        ("charging", ctypes.c_int32),
+        ("discharging", ctypes.c_int32),
+        ("fullness", ctypes.c_int32),
+        ("mins_left", ctypes.c_int32),
+        ("mins_to_full", ctypes.c_int32),
+        ("health", ctypes.c_int32),
+        ("health_days_left", ctypes.c_int32),
+        ("milli_cycles", ctypes.c_int64),
+        ("max_capacity", ctypes.c_int64),
+        ("last_full_capacity", ctypes.c_int64),
+        ("current_capacity", ctypes.c_int64),
+        ("volts", ctypes.c_int64),
+        ("rate", ctypes.c_int64),
+    ]
+
+
+class Rates(ctypes.Structure):
+    """struct bc_rates"""
+    _fields_ = [
+        ("worst", ctypes.c_int64),
+        ("mean", ctypes.c_int64),
+        ("secs", ctypes.c_int64),
+    ]
+
+
+def lib_paths():
+    """Where to look for the library, an override, the build tree then the
+    system"""
+    path = os.getenv("BATT_CHECKER_LIB")
+    if path:
+        yield path
+    here = os.path.dirname(os.path.abspath(__file__))
+    yield os.path.join(here, "..", "c_src", "__{}__".format(platform.machine()),
+            "libbattchecker.so")
+    yield from LIB_NAMES
+
+
+def load_lib():
+    """Load the library and declare its functions"""
+    for path in lib_paths():
+        if (path not in LIB_NAMES) and not os.path.exists(path):
+            continue
+        try:
+            lib = ctypes.CDLL(path, use_errno=True)
+        except OSError:
+            continue
+        break
+    else:
+        raise OSError("Can't find " + LIB_NAMES[0])
+
+    if lib.bc_abi_version() != ABI_VERSION:
+        raise OSError("{} ABI {} not {}".format(
+            LIB_NAMES[0], lib.bc_abi_version(), ABI_VERSION))
+
+    lib.bc_read_battery.argtypes = [ctypes.c_char_p, ctypes.c_int,
+            ctypes.POINTER(Battery)]
+    lib.bc_history_open.argtypes = [ctypes.c_char_p, ctypes.c_char_p,
+            ctypes.c_int64]
+    lib.bc_history_open.restype = ctypes.c_void_p
+    lib.bc_history_count.argtypes = [ctypes.c_void_p]
+    lib.bc_history_count.restype = ctypes.c_size_t
+    lib.bc_history_column.argtypes = [ctypes.c_void_p, ctypes.c_int]
+    lib.bc_history_column.restype = ctypes.c_void_p
+    lib.bc_history_rates.argtypes = [ctypes.c_void_p, ctypes.POINTER(Rates)]
+    lib.bc_history_close.argtypes = [ctypes.c_void_p]
+    lib.bc_history_close.restype = None
+    lib.bc_history_seal.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+    return lib
+
+
+_lib = None
+
+
+def get_lib():
+    global _lib
+    if _lib is None:
+        _lib = load_lib()
+    return _lib
+
+
+def to_bytes(path):
+    return None if path is None else os.fsencode(path)
+
+
+def read_battery(name, health_threshold=80):
+    """The state of a battery (e.g. "BAT0"), None if not present"""
+    battery = Battery()
+    if get_lib().bc_read_battery(to_bytes(name), health_threshold,
+            ctypes.byref(battery)) != 0:
+        return None
+    return battery
+
+
+def seal(log_path=None, seg_dir=None):
+    """Seal the live log into compressed segments"""
+    return get_lib().bc_history_seal(to_bytes(log_path), to_bytes(seg_dir)) == 0
+
+
+class Mapping:
+    """A struct bc_history, closed once nothing refers to it. Each column
+    array refers to it, so it outlives every view of the columns."""
+
+    def __init__(self, lib, handle):
+        self.lib = lib
+        self.handle = handle
+
+    def __del__(self):
+        self.lib.bc_history_close(self.handle)
+
+
+class History:
+    """The whole history, segments then the live log, decoded once.
+
+    Use it as a context manager, the columns are unmapped once it is closed
+    and they are no longer used:
+        with History() as history:
+            capacity = history.column(CAPACITY)
+    """
+
+    mapping = None
+
+    def __init__(self, log_path=None, seg_dir=None, since=0):
+        lib = get_lib()
+        handle = lib.bc_history_open(to_bytes(log_path), to_bytes(seg_dir),
+                since)
+        if not handle:
+            error = ctypes.get_errno()
+            raise OSError(error, "Can't decode history: " + os.strerror(error))
+        self.mapping = Mapping(lib, handle)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *args):
+        self.close()
+
+    def __len__(self):
+        return self.get_mapping().lib.bc_history_count(self.mapping.handle)
+
+    def get_mapping(self):
+        if self.mapping is None:
+            raise ValueError("History is closed")
+        return self.mapping
+
+    def close(self):
+        """Let go of the history, the columns already taken stay valid"""
+        self.mapping = None
+
+    def column(self, column):
+        """A memoryview over a column, int64 ('q') or uint8 ('B') for STATUS"""
+        mapping = self.get_mapping()
+        ctype = ctypes.c_uint8 if column == STATUS else ctypes.c_int64
+        num = len(self)
+        if num == 0:
+            return memoryview(b"").cast(ctype._type_)
+        address = mapping.lib.bc_history_column(mapping.handle, column)
+        if not address:
+            raise ValueError("No column {}".format(column))
+        array = (ctype * num).from_address(address)
+        # The views hold the array, which holds the mapping
+        array.mapping = mapping
+        return memoryview(array).cast("B").cast(ctype._type_)
+
+    def rates(self):
+        """Worst and mean discharge rates (uW), None if not enough history"""
+        mapping = self.get_mapping()
+        rates = Rates()
+        if mapping.lib.bc_history_rates(mapping.handle, ctypes.byref(rates)) != 0:
+            return None
+        return rates
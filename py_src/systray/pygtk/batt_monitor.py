@@ -45,16 +45,21 @@ class SystrayApp:
         gobject.io_add_watch(fd, gobject.IO_IN, self.cb_update_status)
 
     def cb_update_status(self, fd, condition):
-        data = fd.recv(1024)
-        tokens = data.split()
+        data = fd.recv(1024).decode("ascii", "replace")
+        # The state, then the processes using the most energy
+        lines = data.splitlines()
+        tokens = lines[0].split()
         if len(tokens) == 2 and tokens[1] == "ALERT":
             self.alert = True;
         else:
             self.alert = False;
         self.fullness = int(tokens[0])
-        self.tray.set_tooltip(('battery status {} %'.format(
-            self.fullness)
-        ))
+        tooltip = 'battery status {} %'.format(self.fullness)
+        for line in lines[1:4]:
+            fields = line.split("\t")
+            if len(fields) == 3:
+                tooltip += '\n{} {} J'.format(fields[1], fields[2])
+        self.tray.set_tooltip(tooltip)
         if self.alert:
             retVal = self.tray.set_from_icon_name(BATTERY_CAUTION)
         elif self.fullness > 75:
@@ -13,6 +13,10 @@ import sys
 
 from distutils.core import setup
 from distutils.command import install, build
+from distutils.util import change_root
+
+LIB_DIR = "/usr/lib"
+LIB_SONAME = "libbattchecker.so.1"
 
 def find_c_src():
     c_src = "c_src"
@@ -26,9 +30,18 @@ def find_c_src():
 
 
 
+def link_lib(lib_dir):
+    """libbattchecker.so, the name to link with, to the real library"""
+    link = os.path.join(lib_dir, "libbattchecker.so")
+    if os.path.lexists(link):
+        os.remove(link)
+    os.symlink(LIB_SONAME, link)
+
+
 class my_install(install.install):
     def run(self):
         retVal = super().run()
+        link_lib(LIB_DIR if self.root is None else change_root(self.root, LIB_DIR))
         if self.root is None or not self.root.endswith("dumb"):
             if not os.getenv("DONT_START"):
                 print("Setup.py starting the services")
@@ -47,6 +60,18 @@ def get_batt_checker_exe(do_compile=True):
    return os.path.join(find_c_src(), "__%s__" % os.uname().machine, "batt_checker")
 
 
+def get_batt_history_exe():
+   return os.path.join(find_c_src(), "__%s__" % os.uname().machine, "batt_history")
+
+
+def get_batt_collector_exe():
+   return os.path.join(find_c_src(), "__%s__" % os.uname().machine, "batt_collector")
+
+
+def get_batt_checker_lib():
+   return os.path.join(find_c_src(), "__%s__" % os.uname().machine, LIB_SONAME)
+
+
 setup(
     name='batt_checker',
     version='1.1',
@@ -60,6 +85,8 @@ setup(
     data_files=[
         ('/usr/lib/systemd/system',
          ('batt_checker.timer', 'batt_checker.service')),
-        ('/usr/bin/', (get_batt_checker_exe(), ))],
+        ('/usr/bin/', (get_batt_checker_exe(), get_batt_history_exe(),
+            get_batt_collector_exe())),
+        (LIB_DIR, (get_batt_checker_lib(), ))],
     cmdclass={'install': my_install, 'build': my_build}
 )
@@ -0,0 +1,134 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Time the alert rules: compiling a table of rules, then checking simulated
+ * samples of two batteries against it, each discharging with some noise
+ * then recharging.
+ *
+ * Usage: bench_alerts [rules]
+ *
+ * Output:
+ *     rules <n> compile <us> samples <n> ns/sample <ns> ns/rule <ns>
+ *     fired <n>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "alerts.h"
+
+/* Samples checked, per battery */
+#define NUM_SAMPLES 100000
+
+/* Secs between samples */
+#define PERIOD 900
+
+static uint32_t seed = 1;
+
+static int rnd(int range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % range;
+}
+
+static double now_secs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * A mix of rules over all the metrics, for every battery or one of them
+ */
+static void make_rule(int i, char * line, size_t maxlen)
+{
+    static const char * packs[] = {"*", "BAT0", "BAT1"};
+    const char * pack = packs[i % 3];
+    switch((i / 3) % 4)
+    {
+        case 0:
+            snprintf(line, maxlen, "percent %s < %i cooldown %i", pack,
+                    5 + rnd(30), rnd(3) * 15);
+            break;
+
+        case 1:
+            snprintf(line, maxlen, "minutes %s < %i clear %i", pack,
+                    10 + rnd(50), 70);
+            break;
+
+        case 2:
+            snprintf(line, maxlen, "rate %s > %i.%i cooldown 60", pack,
+                    10 + rnd(20), rnd(10));
+            break;
+
+        default:
+            snprintf(line, maxlen, "health %s < %i", pack, 60 + rnd(30));
+            break;
+    }
+}
+
+int main(int argc, char * argv[])
+{
+    const int num_rules = argc > 1 ? atoi(argv[1]) : 500;
+
+    char (* lines)[64] = static_cast<char (*)[64]>(malloc(num_rules * sizeof(*lines)));
+    if(!lines) {
+        return EXIT_FAILURE;
+    }
+    for(int i = 0; i < num_rules; i++) {
+        make_rule(i, lines[i], sizeof(lines[i]));
+    }
+    AlertEngine alerts;
+    double start = now_secs();
+    for(int i = 0; i < num_rules; i++) {
+        alerts.add_rule(lines[i]);
+    }
+    const double compile = now_secs() - start;
+    free(lines);
+
+    const char * names[2] = {"BAT0", "BAT1"};
+    AlertSample samples[2];
+    memset(samples, 0, sizeof(samples));
+    int64_t capacity[2] = {180000000000LL, 90000000000LL};
+    const int64_t full[2] = {180000000000LL, 90000000000LL};
+    unsigned long long fired = 0;
+    time_t now = 1400000000;
+
+    start = now_secs();
+    for(int n = 0; n < NUM_SAMPLES; n++) {
+        now += PERIOD;
+        for(int b = 0; b < 2; b++) {
+            AlertSample & sample = samples[b];
+            const int64_t rate = (6 + rnd(20)) * 1000000LL;
+            capacity[b] -= rate * PERIOD;
+            if(capacity[b] < full[b] / 20) {
+                capacity[b] = full[b];
+            }
+            sample.values[ALERT_PERCENT] = capacity[b] * 100 / full[b];
+            sample.values[ALERT_MINUTES] = capacity[b] / rate / 60;
+            sample.values[ALERT_RATE] = rate;
+            sample.values[ALERT_HEALTH] = 900000 - n;
+            sample.known = (1u << ALERT_NUM_METRICS) - 1;
+            fired += alerts.evaluate(names[b], sample, now);
+        }
+        int left;
+        const char * message;
+        alerts.take_fired(&left, &message);
+    }
+    const double secs = now_secs() - start;
+    const double per_sample = secs * 1e9 / (2.0 * NUM_SAMPLES);
+
+    printf("rules %u compile %.0f samples %i ns/sample %.0f ns/rule %.2f"
+            " fired %llu\n", alerts.num_rules(), compile * 1e6, 2 * NUM_SAMPLES,
+            per_sample, alerts.num_rules() ? per_sample / alerts.num_rules() : 0,
+            fired);
+    return alerts.num_rules() == static_cast<uint32_t>(num_rules)
+        ? EXIT_SUCCESS : EXIT_FAILURE;
+}
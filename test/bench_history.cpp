@@ -0,0 +1,233 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Check and time the compressed history segments against the text log,
+ * using simulated laptop history: a 15 minute timer with up to a minute of
+ * jitter, mostly idle on mains, with some discharge and charge each day and
+ * the odd suspend.
+ *
+ * Usage: bench_history [days]
+ *
+ * Output:
+ *     text <bytes> sealed <bytes> ratio <x> next <M samples/s>
+ *     columns <M samples/s> mismatches <n>
+ *
+ * The decode rates are the median over the repeats, so a busy machine
+ * doesn't skew them as much as it would a total.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "history.h"
+
+/* Samples per segment, about what data.log holds when it is sealed */
+#define SEGMENT_SAMPLES 2000
+
+/* Samples in the segment used to time decoding */
+#define DECODE_SAMPLES 65536
+
+static uint32_t seed = 1;
+
+static int rnd(int range)
+{
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 8) % range;
+}
+
+static double now_secs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static int by_value(const void * a, const void * b)
+{
+    const double diff = *static_cast<const double *>(a) - *static_cast<const double *>(b);
+    return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+/**
+ * The median of the decode times, as M samples/s
+ */
+static double median_rate(double * times, int repeats)
+{
+    qsort(times, repeats, sizeof(double), by_value);
+    return DECODE_SAMPLES / times[repeats / 2] / 1e6;
+}
+
+/**
+ * Generate simulated history
+ */
+static void simulate(HistorySample * samples, int num)
+{
+    const int64_t full = 180000000000LL;       /* 50 Wh */
+    int64_t real_time = 1400000000;
+    int64_t up_time = 1000;
+    int64_t capacity = full;
+    int64_t volts = 12600000;
+    int64_t rate = 8000000;
+    int status = HISTORY_IDLE;
+
+    for(int i = 0; i < num; i++) {
+        const int64_t step = 900 + rnd(60);
+        up_time += step;
+        real_time += step;
+        if(rnd(200) == 0) {
+            /* Suspended for a while */
+            real_time += 600 + rnd(36000);
+        }
+
+        const int hour = (real_time / 3600) % 24;
+        if((hour >= 9) && (hour < 12)) {
+            status = HISTORY_DISCHARGING;
+            rate += (rnd(2000001) - 1000000);
+            if(rate < 4000000) {
+                rate = 4000000;
+            }
+            capacity -= rate * step;
+            volts -= rnd(3) * 10000;
+        }
+        else if(capacity < full) {
+            status = HISTORY_CHARGING;
+            int64_t charge = 40000000;
+            if(capacity > full / 10 * 8) {
+                charge = 2000000 + (full - capacity) / 4500;
+            }
+            capacity += charge * step;
+            volts += rnd(3) * 10000;
+            if(capacity >= full) {
+                capacity = full;
+                volts = 12600000;
+            }
+        }
+        else {
+            status = HISTORY_IDLE;
+        }
+        if(capacity < 0) {
+            capacity = 0;
+        }
+        samples[i].real_time = real_time;
+        samples[i].up_time = up_time;
+        samples[i].status = status;
+        samples[i].capacity = MicroJoules(capacity / 100000 * 100000);
+        samples[i].volts = MicroVolts(volts);
+    }
+}
+
+static bool same(const HistorySample & a, const HistorySample & b)
+{
+    return (a.real_time == b.real_time) && (a.up_time == b.up_time)
+        && (a.status == b.status) && (a.capacity == b.capacity)
+        && (a.volts == b.volts);
+}
+
+int main(int argc, const char * argv[])
+{
+    const int days = argc > 1 ? atoi(argv[1]) : 365;
+    const int num = days * 24 * 4;
+    HistorySample * samples = static_cast<HistorySample *>(
+            malloc(sizeof(HistorySample) * (num > DECODE_SAMPLES ? num : DECODE_SAMPLES)));
+    simulate(samples, num);
+
+    /* Size as text, and as segments, checking they decode to the same */
+    size_t text_bytes = 0;
+    size_t sealed_bytes = 0;
+    int mismatches = 0;
+    char line[256];
+    for(int i = 0; i < num; i++) {
+        text_bytes += history_format_line(samples[i], line, sizeof(line));
+        HistorySample parsed;
+        if(!history_parse_line(line, &parsed) || !same(parsed, samples[i])) {
+            mismatches++;
+        }
+    }
+    HistoryWriter writer;
+    for(int start = 0; start < num; start += SEGMENT_SAMPLES) {
+        writer.reset();
+        const int end = start + SEGMENT_SAMPLES < num ? start + SEGMENT_SAMPLES : num;
+        for(int i = start; i < end; i++) {
+            writer.append(samples[i]);
+        }
+        const uint8_t * data;
+        const size_t length = writer.finish(&data);
+        sealed_bytes += length;
+
+        HistoryReader reader;
+        reader.open(data, length);
+        HistorySample sample;
+        int i = start;
+        while(reader.next(&sample)) {
+            if((i >= end) || !same(sample, samples[i])) {
+                mismatches++;
+            }
+            i++;
+        }
+        if(i != end) {
+            mismatches++;
+        }
+    }
+
+    /* Time decoding of one big segment */
+    simulate(samples, DECODE_SAMPLES);
+    writer.reset();
+    for(int i = 0; i < DECODE_SAMPLES; i++) {
+        writer.append(samples[i]);
+    }
+    const uint8_t * data;
+    const size_t length = writer.finish(&data);
+
+    const int repeats = 200;
+    double times[repeats];
+    volatile int64_t sink = 0;
+    for(int n = 0; n < repeats; n++) {
+        const double start = now_secs();
+        HistoryReader reader;
+        reader.open(data, length);
+        HistorySample sample;
+        while(reader.next(&sample)) {
+            sink += sample.capacity.micro();
+        }
+        times[n] = now_secs() - start;
+    }
+    const double next_rate = median_rate(times, repeats);
+
+    HistoryColumns columns;
+    columns.real_time = static_cast<int64_t *>(malloc(sizeof(int64_t) * DECODE_SAMPLES));
+    columns.up_time = static_cast<int64_t *>(malloc(sizeof(int64_t) * DECODE_SAMPLES));
+    columns.status = static_cast<uint8_t *>(malloc(DECODE_SAMPLES));
+    columns.capacity = static_cast<int64_t *>(malloc(sizeof(int64_t) * DECODE_SAMPLES));
+    columns.volts = static_cast<int64_t *>(malloc(sizeof(int64_t) * DECODE_SAMPLES));
+    for(int n = 0; n < repeats; n++) {
+        const double start = now_secs();
+        HistoryReader reader;
+        reader.open(data, length);
+        if(reader.read_columns(columns, DECODE_SAMPLES) != DECODE_SAMPLES) {
+            mismatches++;
+        }
+        sink += columns.capacity[DECODE_SAMPLES-1];
+        times[n] = now_secs() - start;
+    }
+    const double columns_rate = median_rate(times, repeats);
+    for(int i = 0; i < DECODE_SAMPLES; i++) {
+        if((columns.real_time[i] != samples[i].real_time)
+                || (columns.capacity[i] != samples[i].capacity.micro())
+                || (columns.volts[i] != samples[i].volts.micro())
+                || (columns.status[i] != samples[i].status)) {
+            mismatches++;
+        }
+    }
+
+    printf("text %zu sealed %zu ratio %.1f next %.0f columns %.0f mismatches %i\n",
+            text_bytes, sealed_bytes,
+            static_cast<double>(text_bytes) / sealed_bytes,
+            next_rate, columns_rate, mismatches);
+    return mismatches ? EXIT_FAILURE : EXIT_SUCCESS;
+}
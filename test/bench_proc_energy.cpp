@@ -0,0 +1,180 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Time the energy attribution of a oneshot checker run on a host with a lot
+ * of processes: loading the last run's state, sampling every process and
+ * saving the state again. The processes are in a fake /proc, each with a
+ * stat and an io file. Between runs a few of them use some CPU, and one
+ * (the hog) a lot more.
+ *
+ * Usage: bench_proc_energy [-n processes] [-r runs] [-t budget usecs]
+ *
+ * Output:
+ *     procs <n> run <usecs> sample <usecs> state <bytes> top <comm>
+ */
+
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "proc_energy.h"
+
+#define FIRST_PID 100
+
+static double now_usecs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static int by_value(const void * a, const void * b)
+{
+    const double diff = *static_cast<const double *>(a) - *static_cast<const double *>(b);
+    return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+static bool write_text(const char * path, const char * text)
+{
+    FILE * fp = fopen(path, "w");
+    if(!fp) {
+        return false;
+    }
+    fputs(text, fp);
+    return fclose(fp) == 0;
+}
+
+/**
+ * Write a fake process's stat and io files
+ */
+static bool write_proc(const char * proc_dir, int pid, unsigned long long ticks,
+        unsigned long long io_bytes)
+{
+    char path[256];
+    char text[512];
+    snprintf(path, sizeof(path), "%s/%i", proc_dir, pid);
+    mkdir(path, 0755);
+
+    snprintf(path, sizeof(path), "%s/%i/stat", proc_dir, pid);
+    snprintf(text, sizeof(text), "%i (%s-%i) S 1 1 1 0 -1 4194560 0 0 0 0"
+            " %llu %llu 0 0 20 0 1 0 %i 0 0\n", pid,
+            pid == FIRST_PID ? "hog" : "proc", pid, ticks / 2, ticks - ticks / 2,
+            pid);
+    if(!write_text(path, text)) {
+        return false;
+    }
+    snprintf(path, sizeof(path), "%s/%i/io", proc_dir, pid);
+    snprintf(text, sizeof(text), "rchar: 0\nwchar: 0\nsyscr: 0\nsyscw: 0\n"
+            "read_bytes: %llu\nwrite_bytes: 0\ncancelled_write_bytes: 0\n",
+            io_bytes);
+    return write_text(path, text);
+}
+
+static int remove_entry(const char * path, const struct stat *, int, struct FTW *)
+{
+    return remove(path);
+}
+
+int main(int argc, char * argv[])
+{
+    int procs = 5000;
+    int runs = 20;
+    double budget = 0;
+
+    for(int i = 1; i < argc - 1; i += 2) {
+        switch(argv[i][1])
+        {
+            case 'n':
+                procs = atoi(argv[i+1]);
+                break;
+
+            case 'r':
+                runs = atoi(argv[i+1]);
+                break;
+
+            case 't':
+                budget = atof(argv[i+1]);
+                break;
+        }
+    }
+    if((procs < 1) || (runs < 1)) {
+        fprintf(stderr, "Usage: %s [-n processes] [-r runs] [-t budget usecs]\n",
+                argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    char dir[] = "/tmp/bench_proc_XXXXXX";
+    if(!mkdtemp(dir)) {
+        return EXIT_FAILURE;
+    }
+    char proc_dir[64];
+    char state[64];
+    snprintf(proc_dir, sizeof(proc_dir), "%s/proc", dir);
+    snprintf(state, sizeof(state), "%s/proc_energy", dir);
+    mkdir(proc_dir, 0755);
+
+    unsigned long long * ticks = static_cast<unsigned long long *>(
+            calloc(procs, sizeof(unsigned long long)));
+    double * run_times = static_cast<double *>(calloc(runs, sizeof(double)));
+    double * sample_times = static_cast<double *>(calloc(runs, sizeof(double)));
+    bool ok = ticks && run_times && sample_times;
+    for(int i = 0; ok && (i < procs); i++) {
+        ok = write_proc(proc_dir, FIRST_PID + i, 0, 0);
+    }
+
+    char top[PROC_ENERGY_TOP_N * 64] = "";
+    for(int r = 0; ok && (r <= runs); r++) {
+        /* What ran since the last run, 1 in 20 and the hog */
+        for(int i = r % 20; i < procs; i += 20) {
+            ticks[i] += 1 + i % 7;
+            write_proc(proc_dir, FIRST_PID + i, ticks[i], ticks[i] * 4096);
+        }
+        ticks[0] += 500;
+        write_proc(proc_dir, FIRST_PID, ticks[0], 0);
+
+        const double start = now_usecs();
+        ProcEnergy energy(proc_dir);
+        energy.load(state);
+        const double sample_start = now_usecs();
+        energy.sample(MicroWatts(10000000));
+        const double sample_end = now_usecs();
+        energy.save(state);
+        /* The first run only primes the state */
+        if(r > 0) {
+            run_times[r - 1] = now_usecs() - start;
+            sample_times[r - 1] = sample_end - sample_start;
+        }
+        energy.format_top(top, sizeof(top));
+    }
+
+    struct stat st;
+    const long state_size = stat(state, &st) == 0 ? st.st_size : 0;
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+    if(!ok) {
+        fprintf(stderr, "Failed to make the processes\n");
+        return EXIT_FAILURE;
+    }
+
+    qsort(run_times, runs, sizeof(double), by_value);
+    qsort(sample_times, runs, sizeof(double), by_value);
+    const double median = run_times[runs / 2];
+    char * comm = strchr(top, '\t');
+    if(comm) {
+        comm++;
+        comm[strcspn(comm, "\t")] = '\0';
+    }
+    printf("procs %i run %.0f sample %.0f state %li top %s\n", procs, median,
+            sample_times[runs / 2], state_size, comm ? comm : "-");
+    free(ticks);
+    free(run_times);
+    free(sample_times);
+    return (budget > 0) && (median > budget) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,216 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Measure the exec to exit time and the peak RSS of a command, and check
+ * them against a budget. Used to keep the oneshot checker cheap to start.
+ *
+ * The time is the median over the runs of spawning the command (with
+ * vfork, so the parent isn't copied) and waiting for it. The peak RSS is
+ * VmHWM of the command's own address space, read just before it exits
+ * (under ptrace), so it doesn't include this program. Most of that is
+ * program text, shared through the page cache, so the private (anonymous)
+ * memory, which each run really costs, is reported too.
+ *
+ * Usage: bench_startup [-n runs] [-t budget usecs] [-m budget KB]
+ *          [-p budget private KB] cmd [args]
+ *
+ * Output:
+ *     median <usecs> min <usecs> rss <KB> private <KB>
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ptrace.h>
+#include <sys/wait.h>
+
+extern char ** environ;
+
+static double now_usecs(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static int by_value(const void * a, const void * b)
+{
+    const double diff = *(const double *)a - *(const double *)b;
+    return diff < 0 ? -1 : diff > 0 ? 1 : 0;
+}
+
+/**
+ * Run the command once, with stdout and stderr to /dev/null
+ *
+ * @return The time taken in usecs, or -1 if it failed
+ */
+static double time_run(char * argv[])
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, 1, 2);
+
+    const double start = now_usecs();
+    pid_t pid;
+    int status = -1;
+    if(posix_spawn(&pid, argv[0], &actions, NULL, argv, environ) == 0) {
+        waitpid(pid, &status, 0);
+    }
+    const double taken = now_usecs() - start;
+    posix_spawn_file_actions_destroy(&actions);
+    return (WIFEXITED(status) && (WEXITSTATUS(status) == 0)) ? taken : -1;
+}
+
+/**
+ * Get a value (in KB) from a /proc file of "Name:   value kB" lines
+ *
+ * @return The value, or -1 if not found
+ */
+static long proc_value(pid_t pid, const char * file, const char * name)
+{
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%i/%s", pid, file);
+    long value = -1;
+    FILE * fp = fopen(path, "r");
+    if(fp) {
+        const size_t length = strlen(name);
+        char line[256];
+        while(fgets(line, sizeof(line), fp)) {
+            if((strncmp(line, name, length) == 0) && (line[length] == ':')) {
+                value = strtol(line + length + 1, NULL, 10);
+            }
+        }
+        fclose(fp);
+    }
+    return value;
+}
+
+/**
+ * Run the command once under ptrace, stopping it as it exits to read its
+ * peak RSS and private memory
+ *
+ * @param[in] argv The command
+ * @param[out] private_kb Set to the private memory in KB
+ *
+ * @return The peak RSS in KB, or -1 if it failed
+ */
+static long peak_rss(char * argv[], long * private_kb)
+{
+    const pid_t pid = fork();
+    if(pid == 0) {
+        const int fd = open("/dev/null", O_WRONLY);
+        dup2(fd, 1);
+        dup2(fd, 2);
+        ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+        raise(SIGSTOP);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+    if(pid < 0) {
+        return -1;
+    }
+
+    long rss = -1;
+    int status;
+    waitpid(pid, &status, 0);
+    ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)PTRACE_O_TRACEEXIT);
+    ptrace(PTRACE_CONT, pid, NULL, NULL);
+    while(waitpid(pid, &status, 0) == pid) {
+        if(WIFEXITED(status) || WIFSIGNALED(status)) {
+            break;
+        }
+        if((status >> 8) == (SIGTRAP | (PTRACE_EVENT_EXIT << 8))) {
+            rss = proc_value(pid, "status", "VmHWM");
+            *private_kb = proc_value(pid, "smaps_rollup", "Anonymous");
+            ptrace(PTRACE_CONT, pid, NULL, NULL);
+        }
+        else {
+            /* Pass on any other signal, but not the exec SIGTRAP */
+            const int sig = WSTOPSIG(status) == SIGTRAP ? 0 : WSTOPSIG(status);
+            ptrace(PTRACE_CONT, pid, NULL, (void *)(long)sig);
+        }
+    }
+    return rss;
+}
+
+int main(int argc, char * argv[])
+{
+    int runs = 200;
+    double budget_usecs = 0;
+    long budget_kb = 0;
+    long budget_private_kb = 0;
+
+    int i;
+    for(i = 1; (i < argc - 1) && (argv[i][0] == '-'); i += 2) {
+        switch(argv[i][1])
+        {
+            case 'n':
+                runs = atoi(argv[i+1]);
+                break;
+
+            case 't':
+                budget_usecs = atof(argv[i+1]);
+                break;
+
+            case 'm':
+                budget_kb = atol(argv[i+1]);
+                break;
+
+            case 'p':
+                budget_private_kb = atol(argv[i+1]);
+                break;
+        }
+    }
+    if((i >= argc) || (runs < 1)) {
+        fprintf(stderr, "Usage: %s [-n runs] [-t budget usecs] [-m budget KB]"
+                " [-p budget private KB] cmd [args]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char ** cmd = &argv[i];
+
+    /* Once first to warm the page cache */
+    if(time_run(cmd) < 0) {
+        fprintf(stderr, "%s failed\n", cmd[0]);
+        return EXIT_FAILURE;
+    }
+    double * times = malloc(sizeof(double) * runs);
+    for(i = 0; i < runs; i++) {
+        times[i] = time_run(cmd);
+    }
+    qsort(times, runs, sizeof(double), by_value);
+    const double median = times[runs / 2];
+    const double fastest = times[0];
+    free(times);
+    long private_kb = -1;
+    const long rss = peak_rss(cmd, &private_kb);
+
+    printf("median %.0f min %.0f rss %li private %li\n", median, fastest, rss,
+            private_kb);
+
+    int ok = (fastest >= 0) && (rss > 0);
+    if((budget_usecs > 0) && (median > budget_usecs)) {
+        fprintf(stderr, "Over budget: %.0f usecs > %.0f\n", median, budget_usecs);
+        ok = 0;
+    }
+    if((budget_kb > 0) && (rss > budget_kb)) {
+        fprintf(stderr, "Over budget: %li KB > %li\n", rss, budget_kb);
+        ok = 0;
+    }
+    if((budget_private_kb > 0) && (private_kb > budget_private_kb)) {
+        fprintf(stderr, "Over budget: %li KB private > %li\n", private_kb,
+                budget_private_kb);
+        ok = 0;
+    }
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -4,10 +4,12 @@
 # Licensed under the GPL License. See LICENSE file in the project root for full license information.  
 ##
 
-CFLAGS=-Wall -O3 -Wextra
-CXXFLAGS=$(CFLAGS)
+CFLAGS=-Wall -O3 -Wextra -fPIC
+CXXFLAGS=$(CFLAGS) -fno-exceptions
 
-CPPFLAGS= -I$(SRCDIR)/../common -DDEBUG
+CPPFLAGS= -I$(SRCDIR)/../common -I$(SRCDIR)/../c_src -DDEBUG
+
+vpath %.cpp $(SRCDIR)/../c_src
 
 RM=rm -f
 CC=gcc
@@ -16,15 +18,79 @@ MAKEDEPEND=gcc -M $(CPPFLAGS)
 LD=gcc
 #-lstdc++
 
+# Budget for a oneshot run of the tiny checker, exec to exit, and its peak
+# RSS (mostly static libc text, shared) and private memory. It is run in
+# STARTUP_ROOT, a fixture with one discharging battery, so what is measured
+# is a real sample.
+STARTUP_BUDGET_USECS=1000
+STARTUP_BUDGET_KB=1024
+STARTUP_BUDGET_PRIVATE_KB=200
+TINY_CHECKER=$(abspath $(SRCDIR)/../c_src/$(notdir $(CURDIR))/batt_checker.tiny)
+STARTUP_ROOT=startup_root
+STARTUP_BATTERY=$(STARTUP_ROOT)/sys/class/power_supply/BAT0
+
+# Budget for the energy attribution of a oneshot run on a host with 5000
+# processes: loading the state, sampling them all and saving it again
+PROC_ENERGY_PROCS=5000
+PROC_ENERGY_BUDGET_USECS=50000
+
 OBJS= glibc_shim.o
+REPLAY_OBJS= charge_replay.o charge_curve.o raw_io.o
+BENCH_UNITS_OBJS= bench_units.o
+BENCH_HISTORY_OBJS= bench_history.o history.o units.o
+BENCH_ALERTS_OBJS= bench_alerts.o alerts.o raw_io.o
+BENCH_STARTUP_OBJS= bench_startup.o
+BENCH_PROC_ENERGY_OBJS= bench_proc_energy.o proc_energy.o raw_io.o units.o
+LOAD_COLLECTOR_OBJS= load_collector.o fleet.o history.o units.o
+
+.PHONY: all startup_budget proc_energy_budget $(STARTUP_ROOT)
+all: glibc_mocks.so charge_replay bench_units bench_history bench_alerts \
+	bench_startup bench_proc_energy load_collector
 
-.PHONY: all
-all: glibc_mocks.so
+startup_budget: bench_startup $(STARTUP_ROOT)
+	cd $(STARTUP_ROOT) && ../bench_startup -t $(STARTUP_BUDGET_USECS) \
+	    -m $(STARTUP_BUDGET_KB) -p $(STARTUP_BUDGET_PRIVATE_KB) $(TINY_CHECKER)
+
+$(STARTUP_ROOT):
+	$(RM) -r $@
+	mkdir -p $(STARTUP_BATTERY) $@/var/cache/batt_checker
+	echo Battery > $(STARTUP_BATTERY)/type
+	echo 1 > $(STARTUP_BATTERY)/present
+	echo Discharging > $(STARTUP_BATTERY)/status
+	echo 40000000 > $(STARTUP_BATTERY)/energy_full_design
+	echo 40000000 > $(STARTUP_BATTERY)/energy_full
+	echo 30000000 > $(STARTUP_BATTERY)/energy_now
+	echo 8000000 > $(STARTUP_BATTERY)/power_now
+	echo 12000000 > $(STARTUP_BATTERY)/voltage_now
+
+proc_energy_budget: bench_proc_energy
+	./bench_proc_energy -n $(PROC_ENERGY_PROCS) -t $(PROC_ENERGY_BUDGET_USECS)
 
 
 glibc_mocks.so : $(OBJS)
 	$(LD) $(LDFLAGS) -shared $(OBJS) -ldl -o $@
 
+charge_replay : $(REPLAY_OBJS)
+	$(LD) $(LDFLAGS) $(REPLAY_OBJS) -lm -o $@
+
+bench_units : $(BENCH_UNITS_OBJS)
+	$(LD) $(LDFLAGS) $(BENCH_UNITS_OBJS) -o $@
+
+bench_history : $(BENCH_HISTORY_OBJS)
+	$(LD) $(LDFLAGS) $(BENCH_HISTORY_OBJS) -o $@
+
+bench_alerts : $(BENCH_ALERTS_OBJS)
+	$(LD) $(LDFLAGS) $(BENCH_ALERTS_OBJS) -o $@
+
+bench_startup : $(BENCH_STARTUP_OBJS)
+	$(LD) $(LDFLAGS) $(BENCH_STARTUP_OBJS) -o $@
+
+bench_proc_energy : $(BENCH_PROC_ENERGY_OBJS)
+	$(LD) $(LDFLAGS) $(BENCH_PROC_ENERGY_OBJS) -o $@
+
+load_collector : $(LOAD_COLLECTOR_OBJS)
+	$(LD) $(LDFLAGS) $(LOAD_COLLECTOR_OBJS) -o $@
+
 %.o : %.c
 	$(CC) -c $(CFLAGS) $(CPPFLAGS) -MMD -o $@ $<
 	@cp $*.d $*.P
@@ -39,4 +105,7 @@ glibc_mocks.so : $(OBJS)
 	@$(RM) $*.d
 	@mv $*.P $*.d
 
--include $(OBJS:.o=.d)
+-include $(OBJS:.o=.d) $(REPLAY_OBJS:.o=.d) $(BENCH_UNITS_OBJS:.o=.d) \
+	$(BENCH_HISTORY_OBJS:.o=.d) $(BENCH_ALERTS_OBJS:.o=.d) \
+	$(BENCH_STARTUP_OBJS:.o=.d) $(BENCH_PROC_ENERGY_OBJS:.o=.d) \
+	$(LOAD_COLLECTOR_OBJS:.o=.d)
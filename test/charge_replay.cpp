@@ -0,0 +1,96 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Replay charge sessions through the ChargeCurve and compare its time to
+ * full estimates with those from the plain (full - current) / rate.
+ *
+ * Input (stdin), one sample per line, each session ends when full:
+ *     <session> <secs> <current J> <full J> <rate J/s>
+ *
+ * Output:
+ *     learnt <mean abs error mins> naive <mean abs error mins>
+ *
+ * Each session is scored with the curve learnt from the sessions before it,
+ * so the first session is only used for learning.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "charge_curve.h"
+
+#define MAX_SAMPLES 4096
+
+struct Sample
+{
+    float secs;
+    float current;
+    float full;
+    float rate;
+};
+
+static Sample samples[MAX_SAMPLES];
+
+static MicroJoules to_ujoules(float joules)
+{
+    return MicroJoules(static_cast<int64_t>(joules * 1e6));
+}
+
+static MicroWatts to_uwatts(float watts)
+{
+    return MicroWatts(static_cast<int64_t>(watts * 1e6));
+}
+
+int main()
+{
+    ChargeCurve curve("replay");
+    double learnt_err = 0;
+    double naive_err = 0;
+    int scored = 0;
+    int sessions = 0;
+
+    int session, next_session;
+    Sample next;
+    int got = scanf("%i %f %f %f %f", &next_session, &next.secs,
+            &next.current, &next.full, &next.rate);
+    while(got == 5) {
+        session = next_session;
+        int num = 0;
+        while((got == 5) && (next_session == session)) {
+            if(num < MAX_SAMPLES) {
+                samples[num++] = next;
+            }
+            got = scanf("%i %f %f %f %f", &next_session, &next.secs,
+                    &next.current, &next.full, &next.rate);
+        }
+
+        const float end = samples[num-1].secs;
+        for(int i = 0; (sessions > 0) && (i < num - 1); i++) {
+            const Sample & s = samples[i];
+            const float actual = (end - s.secs) / 60.0;
+            const int learnt = curve.calc_time_to_full(to_ujoules(s.current),
+                    to_ujoules(s.full), to_uwatts(s.rate));
+            const float naive = (s.full - s.current) / s.rate / 60.0;
+            learnt_err += fabs(learnt - actual);
+            naive_err += fabs(naive - actual);
+            scored++;
+        }
+        for(int i = 0; i < num; i++) {
+            curve.learn(to_ujoules(samples[i].current),
+                    to_ujoules(samples[i].full), to_uwatts(samples[i].rate));
+        }
+        sessions++;
+    }
+
+    if(!scored) {
+        fprintf(stderr, "Need at least two sessions\n");
+        return EXIT_FAILURE;
+    }
+    printf("learnt %.2f naive %.2f\n", learnt_err / scored, naive_err / scored);
+    return EXIT_SUCCESS;
+}
@@ -18,10 +18,12 @@
 
 typedef int (*open_t)(const char *, int, ...);
 typedef DIR * (*opendir_t)(const char *);
+typedef int (*rename_t)(const char *, const char *);
 
 
 static open_t p_open = NULL;
 static opendir_t p_opendir = NULL;
+static rename_t p_rename = NULL;
 
 
 static const char * tmp_test_dir = NULL;
@@ -35,6 +37,7 @@ static void init(void)
     if(!p_open) {
         p_open = (open_t) dlsym(RTLD_NEXT, "open");
         p_opendir = (opendir_t) dlsym(RTLD_NEXT, "opendir");
+        p_rename = (rename_t) dlsym(RTLD_NEXT, "rename");
 
         tmp_test_dir = getenv("TMP_TEST_DIR");
         const char * sock_name = getenv("TMP_MOCK_FROM");
@@ -76,7 +79,8 @@ static void log_event(const char * fmt, ...)
         buf[n] = '\0';
     }
     if(sock_fd) {
-        ssize_t len = sendto(sock_fd, buf, n, 0,
+        /* Never held up by a test that isn't reading them */
+        ssize_t len = sendto(sock_fd, buf, n, MSG_DONTWAIT,
                     (const struct sockaddr *)&from_mock_addr,
                     sizeof(from_mock_addr));
         if(len == n) {
@@ -157,3 +161,20 @@ DIR * opendir(const char * name)
     free((void *) name);
     return retVal;
 }
+
+/**
+ * mock for the rename API
+ */
+int rename(const char * oldpath, const char * newpath)
+{
+    ENTER_MOCK;
+
+    log_event("rename(%s, %s)", oldpath, newpath);
+
+    oldpath = modify_path(oldpath);
+    newpath = modify_path(newpath);
+    int retVal = p_rename(oldpath, newpath);
+    free((void *) oldpath);
+    free((void *) newpath);
+    return retVal;
+}
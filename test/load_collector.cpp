@@ -0,0 +1,212 @@
+/**
+ * Copyright (c) 2014 Peter Leese
+ *
+ * Licensed under the GPL License. See LICENSE file in the project root for full license information.
+ */
+
+/**
+ * Load a batt_collector with a simulated fleet. Each host has one battery,
+ * of one of a few models with their own typical discharge rate, and uploads
+ * its batches of samples one after another, as the checker does. The hosts
+ * are shared between worker processes, each uploading for one host at a
+ * time, so there are that many uploads in flight.
+ *
+ * Usage: load_collector [-n hosts] [-b batches per host]
+ *          [-s samples per batch] [-w workers] [-o clock offset secs] address
+ *
+ * Output:
+ *     hosts <n> batches <n> samples <n> secs <s> batches/s <n> failed <n>
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "fleet.h"
+#include "history.h"
+
+#define NUM_MODELS 8
+
+/* Secs between samples, the checker's default period */
+#define PERIOD 900
+
+/* Secs the hosts' clocks are off by, as after a clock step */
+static int64_t clock_offset = 0;
+
+/**
+ * What a worker did, sent back over a pipe
+ */
+struct WorkerResult
+{
+    unsigned long long batches;
+    unsigned long long samples;
+    unsigned long long failed;
+};
+
+/**
+ * A simulated host's battery
+ */
+struct SimHost
+{
+    uint32_t seed;
+    int model;
+    int64_t index;              /* Samples so far */
+    int64_t capacity;           /* uJ */
+};
+
+static int rnd(SimHost * host, int range)
+{
+    host->seed = host->seed * 1103515245 + 12345;
+    return (host->seed >> 8) % range;
+}
+
+static double now_secs()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Simulate a batch of a host's samples: discharging at around its model's
+ * rate (4 W for the first model, 2 W more for each after), recharged once
+ * below 10%
+ */
+static void simulate(SimHost * host, HistoryWriter * writer, int samples)
+{
+    const int64_t full = 180000000000LL;       /* 50 Wh */
+    writer->reset();
+    for(int i = 0; i < samples; i++, host->index++) {
+        HistorySample sample;
+        sample.real_time = 1400000000 + clock_offset + host->index * PERIOD;
+        sample.up_time = 1000 + host->index * PERIOD;
+        sample.status = HISTORY_DISCHARGING;
+        if(host->capacity < full / 10) {
+            host->capacity = full;
+            sample.status = HISTORY_CHARGING;
+        }
+        sample.capacity = MicroJoules(host->capacity);
+        sample.volts = MicroVolts(11000000 + host->capacity / 100000);
+        writer->append(sample);
+
+        const int64_t rate = (4 + 2 * host->model) * 1000000LL
+            * (80 + rnd(host, 41)) / 100;
+        host->capacity -= rate * PERIOD;
+    }
+}
+
+/**
+ * Upload all the batches of every workers'th host
+ */
+static WorkerResult run_worker(const char * addr, int worker, int workers,
+        int hosts, int batches, int samples)
+{
+    WorkerResult result;
+    memset(&result, 0, sizeof(result));
+    HistoryWriter writer;
+    for(int h = worker; h < hosts; h += workers) {
+        SimHost host;
+        memset(&host, 0, sizeof(host));
+        host.seed = h + 1;
+        host.model = h % NUM_MODELS;
+        host.capacity = 180000000000LL - rnd(&host, 100) * 1000000000LL;
+
+        FleetUpload upload;
+        memset(&upload, 0, sizeof(upload));
+        snprintf(upload.host, sizeof(upload.host), "sim-%06d", h);
+        strcpy(upload.battery, "BAT0");
+        snprintf(upload.model, sizeof(upload.model), "Sim Model-%d", host.model);
+        for(int b = 0; b < batches; b++) {
+            simulate(&host, &writer, samples);
+            upload.segment_length = writer.finish(&upload.segment);
+            if(fleet_send(addr, upload, 30)) {
+                result.batches++;
+                result.samples += writer.count();
+            }
+            else {
+                result.failed++;
+            }
+        }
+    }
+    return result;
+}
+
+int main(int argc, char * argv[])
+{
+    int hosts = 10000;
+    int batches = 1;
+    int samples = 96;
+    int workers = 32;
+
+    int i;
+    for(i = 1; (i < argc - 1) && (argv[i][0] == '-'); i += 2) {
+        switch(argv[i][1])
+        {
+            case 'n':
+                hosts = atoi(argv[i+1]);
+                break;
+
+            case 'b':
+                batches = atoi(argv[i+1]);
+                break;
+
+            case 's':
+                samples = atoi(argv[i+1]);
+                break;
+
+            case 'w':
+                workers = atoi(argv[i+1]);
+                break;
+
+            case 'o':
+                clock_offset = atoll(argv[i+1]);
+                break;
+        }
+    }
+    if((i >= argc) || (workers < 1) || (samples < 1)) {
+        fprintf(stderr, "Usage: %s [-n hosts] [-b batches per host]"
+                " [-s samples per batch] [-w workers] [-o clock offset secs]"
+                " address\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    const char * addr = argv[i];
+
+    int fds[2];
+    if(pipe(fds) != 0) {
+        return EXIT_FAILURE;
+    }
+    const double start = now_secs();
+    for(int w = 0; w < workers; w++) {
+        if(fork() == 0) {
+            close(fds[0]);
+            const WorkerResult result = run_worker(addr, w, workers, hosts,
+                    batches, samples);
+            const bool sent = write(fds[1], &result, sizeof(result)) == sizeof(result);
+            _exit(sent ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
+    }
+    close(fds[1]);
+
+    WorkerResult total;
+    memset(&total, 0, sizeof(total));
+    WorkerResult result;
+    int reported = 0;
+    while(read(fds[0], &result, sizeof(result)) == sizeof(result)) {
+        total.batches += result.batches;
+        total.samples += result.samples;
+        total.failed += result.failed;
+        reported++;
+    }
+    while(wait(NULL) > 0) {
+    }
+    const double secs = now_secs() - start;
+
+    printf("hosts %i batches %llu samples %llu secs %.2f batches/s %.0f"
+            " failed %llu\n", hosts, total.batches, total.samples, secs,
+            total.batches / secs, total.failed);
+    return (reported == workers) && (total.failed == 0) ? EXIT_SUCCESS
+        : EXIT_FAILURE;
+}
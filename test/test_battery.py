@@ -7,6 +7,7 @@
 ##
 
 
+import gc
 import sys
 import os
 import unittest
@@ -14,9 +15,13 @@ import subprocess
 import platform
 import shutil
 import socket
+import random
 
 test_dir = os.path.join(os.path.abspath(os.path.dirname(__file__)))
 
+sys.path.insert(0, os.path.join(test_dir, ".."))
+from py_src import battlib
+
 def tmp_test_dir():
     return os.path.join(test_dir, "tmp")
 
@@ -40,21 +45,72 @@ def glibc_mocks():
             )
     )
 
+def test_exe(name):
+    """A program built in test/"""
+    return os.path.abspath(
+            os.path.join(
+                    test_dir,
+                    "__{}__".format(platform.machine()),
+                    name
+            )
+    )
+
+# Not a test itself, for pytest
+test_exe.__test__ = False
+
+def tiny_checker_exe():
+    return chk_battery_exe() + ".tiny"
+
+def collector_exe():
+    return os.path.join(os.path.dirname(chk_battery_exe()), "batt_collector")
+
+def charge_sessions(num, full=180000.0, cc_rate=40.0, period=60):
+    """Simulated constant current then constant voltage charge sessions"""
+    rnd = random.Random(1)
+    lines = []
+    for session in range(num):
+        current = full * rnd.uniform(0.05, 0.5)
+        secs = 0
+        while current < full:
+            soc = current / full
+            rate = cc_rate
+            if soc > 0.8:
+                # Taper once into constant voltage
+                rate = 1.0 + (cc_rate - 1.0) * (1.0 - soc) / 0.2
+            measured = rate * rnd.uniform(0.97, 1.03)
+            lines.append("{} {} {} {} {}".format(
+                session, secs, current, full, measured))
+            current = min(full, current + rate * period)
+            secs += period
+        lines.append("{} {} {} {} {}".format(session, secs, full, full, 0))
+    return "\n".join(lines) + "\n"
+
+def discharge_log(num, rate=8.0, period=900):
+    """A data.log of a steady discharge, with one suspend half way"""
+    lines = []
+    real_time, up_time, capacity = 1400000000, 1000, 180000.0
+    for i in range(num):
+        lines.append("{}\t{}\t\\\t{:9.1f}\t{:.2f}\n".format(
+            real_time, up_time, capacity, 12.0))
+        real_time += period + (36000 if i == num // 2 else 0)
+        up_time += period
+        capacity -= rate * period
+    return "".join(lines)
+
 def unix_mock_from():
     return os.path.join(tmp_test_dir(), ".from_mock")
 
 def unix_alert_sock():
     return os.path.join(tmp_test_dir(), ".from_batt_checker")
 
-def run():
-    args = [chk_battery_exe(), "-s", unix_alert_sock()]
+def run(*options):
+    """Run the checker in the test dir, returning what it printed"""
+    args = [chk_battery_exe(), "-s", unix_alert_sock()] + list(options)
     env = dict(os.environ)
     env["TMP_TEST_DIR"] = tmp_test_dir()
     env["LD_PRELOAD"] = glibc_mocks()
     env["TMP_MOCK_FROM"] = unix_mock_from()
-
-    proc = subprocess.Popen(args, env=env)
-    proc.wait()
+    return subprocess.check_output(args, env=env)
 
 
 def set_proc(base, name, value):
@@ -74,6 +130,42 @@ def set_proc(base, name, value):
     with open(path, "wb") as out_fp:
         out_fp.write(str(value).encode("ascii"))
 
+def set_battery(base, **values):
+    """Fill in a battery's sysfs files, after set_proc() made it"""
+    for name, value in values.items():
+        with open(os.path.join(tmp_test_dir(), "sys/class/power_supply", base,
+                name), "w") as out_fp:
+            out_fp.write(str(value))
+
+def set_fake_proc(pid, comm, ticks, start_time):
+    """Make or update a process in the fake /proc"""
+    path = os.path.join(tmp_test_dir(), "proc", str(pid))
+    if not os.path.exists(path):
+        os.makedirs(path)
+    with open(os.path.join(path, "stat"), "w") as out_fp:
+        out_fp.write("{} ({}) S 1 1 1 0 -1 4194560 0 0 0 0 {} 0 0 0 20 0 1 0 "
+                "{} 0 0\n".format(pid, comm, ticks, start_time))
+    with open(os.path.join(path, "io"), "w") as out_fp:
+        out_fp.write("read_bytes: 0\nwrite_bytes: 0\n")
+
+def set_boot_id(boot_id):
+    """Set the boot id in the fake /proc"""
+    path = os.path.join(tmp_test_dir(), "proc/sys/kernel/random")
+    if not os.path.exists(path):
+        os.makedirs(path)
+    with open(os.path.join(path, "boot_id"), "w") as out_fp:
+        out_fp.write(boot_id + "\n")
+
+def drain(sock):
+    """What has been sent to a (non blocking) socket"""
+    msgs = []
+    try:
+        while True:
+            msgs.append(sock.recv(256))
+    except BlockingIOError:
+        pass
+    return msgs
+
 def create_listening_socks():
     if not os.path.exists(tmp_test_dir()):
         os.mkdir(tmp_test_dir())
@@ -127,6 +219,284 @@ class TestFunctions(unittest.TestCase):
         set_proc("BAT0", "type", "battery")
         run()
 
+    def test_health_threshold(self):
+        set_proc("BAT0", "type", "battery")
+        set_battery("BAT0", present=1, status="Discharging",
+                energy_full_design=40000000, power_now=8000000,
+                voltage_now=12000000)
+        os.makedirs(os.path.join(tmp_test_dir(), "var/cache/batt_checker"))
+        state_path = os.path.join(tmp_test_dir(),
+                "var/cache/batt_checker/health_BAT0")
+        # A run a day, losing 1% of the design capacity and 2 Wh of charge
+        # each day
+        for day in range(10):
+            if day:
+                # As though the last run was a day earlier
+                with open(state_path) as in_fp:
+                    fields = in_fp.read().split()
+                for i in (1, 2, 3):
+                    fields[i] = str(int(fields[i]) - 24 * 60 * 60)
+                with open(state_path, "w") as out_fp:
+                    out_fp.write(" ".join(fields) + "\n")
+            set_battery("BAT0", energy_full=40000000 - 400000 * day,
+                    energy_now=30000000 - 2000000 * day)
+            out = run("-H", "80")
+
+        with open(state_path) as in_fp:
+            fields = in_fp.read().split()
+        last_full, design = int(fields[5]), int(fields[6])
+        micro_cycles = int(fields[8])
+        n, sx, sy, sxx, sxy = (float(f) for f in fields[9:14])
+        # Full is 36.4 of 40 Wh
+        self.assertAlmostEqual(last_full / design, 0.91, places=6)
+        # 2 Wh used a day, as a fraction of that day's full
+        cycles = sum(2.0 / (40.0 - 0.4 * day) for day in range(1, 10))
+        self.assertAlmostEqual(micro_cycles / 1e6, cycles, places=5)
+        # Health falls 1% a day from 100%, so reaches 80% on day 20
+        self.assertEqual(n, 10)
+        slope = (n * sxy - sx * sy) / (n * sxx - sx * sx)
+        intercept = (sy - slope * sx) / n
+        self.assertAlmostEqual(slope, -0.01, places=5)
+        self.assertAlmostEqual(intercept, 1.0, places=5)
+        self.assertIn(b"11 days before health below 80%", out)
+
+    def test_proc_energy(self):
+        set_proc("BAT0", "type", "battery")
+        set_battery("BAT0", present=1, status="Discharging",
+                energy_full=40000000, energy_now=30000000,
+                power_now=8000000, voltage_now=12000000)
+        cache = os.path.join(tmp_test_dir(), "var/cache/batt_checker")
+        os.makedirs(cache)
+        set_fake_proc(200, "busy", 1000, 70)
+        set_fake_proc(201, "idle", 50, 71)
+        set_boot_id("first-boot")
+        run("-e")
+        self.assertEqual(open(os.path.join(cache, "top_energy")).read(), "")
+
+        # As though the next run is 10 mins later, busy using 3 times the CPU
+        state_path = os.path.join(cache, "proc_energy")
+        with open(state_path) as in_fp:
+            header, rest = in_fp.read().split("\n", 1)
+        version, last, boot_id = header.split()
+        self.assertEqual(boot_id, "first-boot")
+        with open(state_path, "w") as out_fp:
+            out_fp.write("{} {} {}\n{}".format(version, int(last) - 600000,
+                boot_id, rest))
+        set_fake_proc(200, "busy", 1300, 70)
+        set_fake_proc(201, "idle", 150, 71)
+        self.socks[1].setblocking(False)
+        drain(self.socks[1])
+        run("-e")
+
+        # 8 W for 10 mins is 4800 J, shared 3 to 1
+        with open(os.path.join(cache, "top_energy")) as in_fp:
+            top = [line.split("\t") for line in in_fp.read().splitlines()]
+        self.assertEqual([(pid, comm) for pid, comm, joules in top],
+                [("200", "busy"), ("201", "idle")])
+        self.assertAlmostEqual(float(top[0][2]), 3600, delta=1)
+        self.assertAlmostEqual(float(top[1][2]), 1200, delta=1)
+        # And with the rest of the state to the listener
+        msg = drain(self.socks[1])[-1].decode("ascii").splitlines()
+        self.assertEqual(msg[1].split("\t")[:2], ["200", "busy"])
+
+        # After a reboot the old state is dropped, the pids are new processes
+        set_boot_id("second-boot")
+        set_fake_proc(200, "busy", 1600, 70)
+        run("-e")
+        self.assertEqual(open(os.path.join(cache, "top_energy")).read(), "")
+
+    def test_proc_energy_bench(self):
+        # Times as the proc_energy_budget make target, without the budget
+        out = subprocess.check_output([test_exe("bench_proc_energy"),
+            "-n", "5000", "-r", "3"])
+        print("Energy attribution", out.decode("ascii").strip())
+        self.assertEqual(out.split()[-1], b"hog-100")
+
+    def test_charge_replay(self):
+        out = subprocess.check_output([test_exe("charge_replay")],
+                input=charge_sessions(10).encode("ascii"))
+        tokens = out.split()
+        learnt, naive = float(tokens[1]), float(tokens[3])
+        print("Time to full error: learnt", learnt, "naive", naive)
+        self.assertLess(learnt, 5.0)
+        self.assertLess(learnt, naive / 4)
+
+    def test_bad_charge_curve(self):
+        set_proc("BAT0", "type", "battery")
+        set_battery("BAT0", present=1, status="Charging",
+                energy_full=40000000, energy_now=20000000,
+                power_now=20000000, voltage_now=12000000)
+        cache = os.path.join(tmp_test_dir(), "var/cache/batt_checker")
+        os.makedirs(cache)
+        # Learnt buckets with no rate, which would be divided by
+        with open(os.path.join(cache, "charge_curve_BAT0"), "w") as out_fp:
+            out_fp.write("2\n" + "0 5\n" * 20)
+        out = run()
+        self.assertIn(b"Charging", out)
+
+    def test_history_segments(self):
+        out = subprocess.check_output([test_exe("bench_history"), "60"])
+        tokens = out.split()
+        ratio, mismatches = float(tokens[5]), int(tokens[11])
+        print("History compression ratio", ratio)
+        self.assertEqual(mismatches, 0)
+        self.assertGreater(ratio, 10.0)
+
+    def test_library_history(self):
+        log_path = os.path.join(tmp_test_dir(), "data.log")
+        seg_dir = os.path.join(tmp_test_dir(), "history")
+        with open(log_path, "w") as out_fp:
+            out_fp.write(discharge_log(20))
+        with battlib.History(log_path, seg_dir) as history:
+            before = bytes(history.column(battlib.CAPACITY))
+            self.assertEqual(len(history), 20)
+            rates = history.rates()
+            self.assertEqual(rates.worst, 8000000)
+            self.assertEqual(rates.secs, 18 * 900)
+        self.assertTrue(battlib.seal(log_path, seg_dir))
+        self.assertEqual(os.path.getsize(log_path), 0)
+        with battlib.History(log_path, seg_dir, since=1400000000 + 900) as history:
+            self.assertEqual(len(history), 19)
+            self.assertEqual(bytes(history.column(battlib.CAPACITY)), before[8:])
+            self.assertEqual(history.column(battlib.STATUS).tolist(),
+                    [battlib.DISCHARGING] * 19)
+            times = history.column(battlib.REAL_TIME)[1:]
+        # What was taken from a column outlives the history
+        del history
+        gc.collect()
+        self.assertEqual(len(times), 18)
+        self.assertEqual(times[0], 1400000000 + 2 * 900)
+
+    def test_startup_bench(self):
+        # The startup_budget make target, which fails if the tiny checker
+        # is over the time or memory budget in build.mk. A busy machine can
+        # push the median time over, so it has a few tries.
+        for attempt in range(3):
+            result = subprocess.run(["make", "-s", "-C", test_dir,
+                "startup_budget"], stdout=subprocess.PIPE)
+            print("Tiny checker startup", result.stdout.decode("ascii").strip())
+            if result.returncode == 0:
+                break
+        self.assertEqual(result.returncode, 0)
+        # Each run, the warm up and the one for the memory, took a sample
+        root = test_exe("startup_root")
+        with open(os.path.join(root, "var/cache/batt_checker/data.log")) as in_fp:
+            self.assertEqual(len(in_fp.readlines()), 200 + 2)
+
+    def test_alert_rules(self):
+        with open(os.path.join(tmp_test_dir(), "alerts"), "w") as out_fp:
+            out_fp.write("# Floor with hysteresis\n"
+                    "percent * < 20 clear 25\n"
+                    "minutes BAT1 < 1000\n"
+                    "percent * > 10 clear 20\n")
+        set_proc("BAT0", "type", "battery")
+        set_battery("BAT0", present=1, status="Discharging",
+                energy_full=40000000, power_now=8000000,
+                voltage_now=12000000)
+        # For the state kept between runs
+        os.makedirs(os.path.join(tmp_test_dir(), "var/cache/batt_checker"))
+        self.socks[1].setblocking(False)
+        alerts = []
+        # Fires going below 20%, not again until it has been back over 25%
+        for percent in (15, 15, 22, 30, 22, 15):
+            set_battery("BAT0", energy_now=400000 * percent)
+            run("-a", "/alerts")
+            alerts.append(any(msg.split()[1:] == [b"ALERT"]
+                for msg in drain(self.socks[1])))
+        self.assertEqual(alerts, [True, False, False, False, False, True])
+
+        # Not one rule that can be used, so the default minutes left rule
+        with open(os.path.join(tmp_test_dir(), "alerts"), "w") as out_fp:
+            out_fp.write("percent * <\n")
+        set_battery("BAT0", energy_now=400000)
+        # With no respawn period, so it doesn't stay for the reminders
+        run("-a", "/alerts", "-p", "0")
+        self.assertTrue(any(msg.split()[1:] == [b"ALERT"]
+            for msg in drain(self.socks[1])))
+
+    def test_alert_spike(self):
+        with open(os.path.join(tmp_test_dir(), "alerts"), "w") as out_fp:
+            out_fp.write("spike * > 200\n")
+        set_proc("BAT0", "type", "battery")
+        set_battery("BAT0", present=1, status="Discharging",
+                energy_full=40000000, energy_now=30000000,
+                voltage_now=12000000)
+        os.makedirs(os.path.join(tmp_test_dir(), "var/cache/batt_checker"))
+        self.socks[1].setblocking(False)
+        alerts = []
+        # Nothing until there is an average, then only well above it
+        for watts in (8, 9, 7, 8, 15, 20):
+            set_battery("BAT0", power_now=watts * 1000000)
+            run("-a", "/alerts")
+            alerts.append(any(msg.split()[1:] == [b"ALERT"]
+                for msg in drain(self.socks[1])))
+        self.assertEqual(alerts, [False, False, False, False, False, True])
+
+    def test_alert_bench(self):
+        out = subprocess.check_output([test_exe("bench_alerts"), "500"])
+        tokens = out.split()
+        print("Alert rules", out.decode("ascii").strip())
+        self.assertEqual(int(tokens[1]), 500)
+        # Against the millisecond or so a sample takes
+        self.assertLess(float(tokens[7]), 50000)
+
+    def test_fleet_collector(self):
+        store = os.path.join(tmp_test_dir(), "store")
+        sock = os.path.join(tmp_test_dir(), "collector.sock")
+        collector = subprocess.Popen([collector_exe(), "-d", store, "-l", sock],
+                stdout=subprocess.PIPE)
+        try:
+            collector.stdout.readline()
+            out = subprocess.check_output([test_exe("load_collector"),
+                "-n", "10000", "-b", "2", sock])
+            print("Fleet load", out.decode("ascii").strip())
+            # Resent batches are only stored once
+            subprocess.check_call([test_exe("load_collector"), "-n", "100",
+                "-w", "4", sock])
+            # As are the samples of a resend with more added since, only the
+            # last 58 are new
+            subprocess.check_call([test_exe("load_collector"), "-n", "100",
+                "-w", "4", "-s", "250", sock])
+
+            # The checker only uploads once it has queued a batch
+            set_proc("BAT0", "type", "battery")
+            set_battery("BAT0", present=1, status="Discharging",
+                    energy_full=40000000, energy_now=30000000,
+                    power_now=8000000, voltage_now=12000000,
+                    model_name="Cell 5")
+            outbox = os.path.join(tmp_test_dir(), "var/cache/batt_checker")
+            os.makedirs(outbox)
+            outbox = os.path.join(outbox, "outbox_BAT0")
+            self.socks[1].setblocking(False)
+            runs = 0
+            queued = 0
+            while runs < 200:
+                run("-c", sock)
+                drain(self.socks[1])
+                runs += 1
+                if os.path.getsize(outbox) < queued:
+                    break
+                queued = os.path.getsize(outbox)
+        finally:
+            collector.terminate()
+            collector.wait()
+        self.assertGreater(runs, 50)
+        self.assertLess(runs, 200)
+
+        stats = subprocess.check_output([collector_exe(), "-d", store, "-q",
+            "stats"]).split()
+        self.assertEqual(stats[1], b"10001")
+        self.assertEqual(int(stats[5]), 20001 + 100)
+        self.assertEqual(int(stats[7]), 10000 * 2 * 96 + 100 * 58 + runs)
+        rates = subprocess.check_output([collector_exe(), "-d", store, "-q",
+            "rates"]).decode("ascii").splitlines()
+        self.assertEqual(len(rates), 8)
+        for model, line in enumerate(rates):
+            name, batteries, intervals, p50, p95, worst = line.split("\t")
+            self.assertEqual(name, "Sim Model-{}".format(model))
+            self.assertEqual(int(batteries), 1250)
+            self.assertAlmostEqual(float(p95), (4 + 2 * model) * 1.18, delta=0.5)
+
 
 if __name__ == '__main__':
     unittest.main()